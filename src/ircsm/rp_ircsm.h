@@ -3,12 +3,64 @@
 
 #include <stdlib.h>
 #include <rp_string.h>
-#include <rp_palloc.h>
 
+#define RP_IRCSM_MAX_PARAMS 15
+
+// command ids, numerics use their value (0-999) and the known verbs are
+// numbered after them. anything else is RP_IRCSM_CMD_UNKNOWN.
+enum {
+	RP_IRCSM_CMD_UNKNOWN = 1000,
+	RP_IRCSM_CMD_PRIVMSG,
+	RP_IRCSM_CMD_NOTICE,
+	RP_IRCSM_CMD_PING,
+	RP_IRCSM_CMD_PONG,
+	RP_IRCSM_CMD_JOIN,
+	RP_IRCSM_CMD_PART,
+	RP_IRCSM_CMD_QUIT,
+	RP_IRCSM_CMD_NICK,
+	RP_IRCSM_CMD_MODE,
+	RP_IRCSM_CMD_TOPIC,
+	RP_IRCSM_CMD_KICK,
+	RP_IRCSM_CMD_INVITE,
+	RP_IRCSM_CMD_KILL,
+	RP_IRCSM_CMD_ERROR,
+	RP_IRCSM_CMD_AWAY,
+	RP_IRCSM_CMD_CAP,
+	RP_IRCSM_CMD_AUTHENTICATE,
+	RP_IRCSM_CMD_ACCOUNT,
+	RP_IRCSM_CMD_CHGHOST,
+	RP_IRCSM_CMD_SETNAME,
+	RP_IRCSM_CMD_BATCH,
+	RP_IRCSM_CMD_TAGMSG,
+	RP_IRCSM_CMD_WALLOPS,
+	RP_IRCSM_CMD_MAX
+};
+
+// results of rp_ircsm_parse
+#define RP_IRCSM_AGAIN   0 // no complete message yet
+#define RP_IRCSM_OK      1
+#define RP_IRCSM_SKIPPED 2 // not in the interest set, only code/cmd are set
+#define RP_IRCSM_MALFORMED 3 // rejected by the grammar, only line is set
+
+// bitmap of command ids, messages whose command is not in it are skipped
+// by the parser without extracting their fields.
+#define RP_IRCSM_INTEREST_SZ ((RP_IRCSM_CMD_MAX + 7) / 8)
+
+#define rp_ircsm_interest_set(_i, _cmd) \
+	((_i)[(_cmd) >> 3] |= (u_char)(1 << ((_cmd) & 7)))
+#define rp_ircsm_interest_test(_i, _cmd) \
+	((_i)[(_cmd) >> 3] & (1 << ((_cmd) & 7)))
+
+// every string in a message is a slice of the buffer that was handed to
+// rp_ircsm_parse, nothing is copied. the strings are only valid for as
+// long as that buffer is left untouched.
 struct rp_ircsm_msg {
-	// the prefix is a shared buffer between the hostmask and the
-	// servername, the strings actually just point to locations
-	// inside of the prefix buffer.
+	rp_str_t  line; // the whole message, including the crlf
+
+	// the ircv3 tag section without the '@', still escaped. single
+	// tags are looked up with rp_ircsm_tag_get.
+	rp_str_t  tags;
+
 	rp_str_t  prefix;
 
 	rp_str_t  servername;
@@ -19,18 +71,129 @@ struct rp_ircsm_msg {
 	} hostmask;
 
 	rp_str_t  code;
+	int       cmd; // command id of code
 	rp_str_t  params;
 
+	// params split up while parsing, the colon of the trailing
+	// parameter is not part of its string.
+	rp_str_t      argv[RP_IRCSM_MAX_PARAMS];
+	unsigned int  argc;
+
+	// interest set for the parser, NULL to parse every message
+	const u_char *interest;
+
+	// the byte the grammar rejected in a malformed message
+	char         *error_at;
+
+	// how far the line at scan_src was searched for its end without
+	// finding it, the next call on the same src goes on from there.
+	const char   *scan_src;
+	size_t        scanned;
+
 	unsigned int is_hostmask:1;
 	unsigned int is_servername:1;
+	unsigned int is_trailing:1; // the last parameter is the trailing one
+	unsigned int is_skipped:1;
+	unsigned int is_malformed:1;
+};
+
+// parse a single message from the start of src. returns RP_IRCSM_OK,
+// RP_IRCSM_SKIPPED or RP_IRCSM_MALFORMED and sets len to the length of the
+// line, or returns RP_IRCSM_AGAIN if src does not hold a complete line yet.
+//
+// after RP_IRCSM_AGAIN a call with the same src only searches the bytes
+// that were added since, so src has to start with the same line then.
+// a caller that drops the line or puts another one there resets msg
+// with rp_ircsm_scan_reset first.
+int rp_ircsm_parse(struct rp_ircsm_msg *msg, const char *src, size_t *len);
+
+#define rp_ircsm_scan_reset(_msg) ((_msg)->scan_src = NULL)
+
+// parse up to max complete messages from src into msgs, skipped messages
+// do not take up a slot but malformed ones do. returns the number of
+// messages parsed and sets len to the number of bytes consumed. the
+// search state of an incomplete line is kept in msgs[0], where the next
+// call starts.
+size_t rp_ircsm_parse_batch(struct rp_ircsm_msg *msgs, size_t max,
+	const char *src, size_t *len);
+
+int rp_ircsm_msg_init(struct rp_ircsm_msg *msg);
+
+// look up the tag key in the tag section of msg. returns 1 and sets value
+// if the tag is present, 0 otherwise. a value that needs unescaping is
+// written to buf, which must hold size bytes, and truncated to fit.
+int rp_ircsm_tag_get(struct rp_ircsm_msg *msg, const char *key,
+	rp_str_t *value, char *buf, size_t size);
+
+// typed views of the high volume numerics, decoded from the argv of an
+// already parsed message. like the message, they point into its buffer.
+
+#define RP_IRCSM_MAX_NAMES 256
+
+struct rp_ircsm_name {
+	rp_str_t  prefix; // membership prefixes, e.g. "@" or "@+"
+	rp_str_t  nick;
+};
+
+// 353 RPL_NAMREPLY
+struct rp_ircsm_names {
+	char                  type; // '=' public, '*' private, '@' secret
+	rp_str_t              channel;
+	size_t                count;
+	struct rp_ircsm_name  names[RP_IRCSM_MAX_NAMES];
+};
+
+// 352 RPL_WHOREPLY
+struct rp_ircsm_who {
+	rp_str_t      channel;
+	rp_str_t      user;
+	rp_str_t      host;
+	rp_str_t      server;
+	rp_str_t      nick;
+	rp_str_t      flags;
+	rp_str_t      realname;
+	unsigned int  hopcount;
+
+	unsigned int  is_away:1;
+	unsigned int  is_oper:1;
 };
 
-int rp_ircsm_init(int *state);
+struct rp_ircsm_isupport_token {
+	rp_str_t      key;
+	rp_str_t      value; // still escaped, empty if there is none
+
+	unsigned int  is_negated:1; // "-KEY"
+};
+
+// 005 RPL_ISUPPORT
+struct rp_ircsm_isupport {
+	size_t                          count;
+	struct rp_ircsm_isupport_token  tokens[RP_IRCSM_MAX_PARAMS];
+};
+
+// decode a 353 reply. prefixes are the membership prefix characters from
+// PREFIX, or NULL for the common default. names beyond RP_IRCSM_MAX_NAMES
+// are dropped. returns -1 if msg is not a valid 353.
+int rp_ircsm_names_decode(struct rp_ircsm_msg *msg, const char *prefixes,
+	struct rp_ircsm_names *names);
+
+// decode a 352 reply. returns -1 if msg is not a valid 352.
+int rp_ircsm_who_decode(struct rp_ircsm_msg *msg, struct rp_ircsm_who *who);
+
+// decode a 005 reply into its tokens, the trailing param is left out.
+// returns -1 if msg is not a 005.
+int rp_ircsm_isupport_decode(struct rp_ircsm_msg *msg,
+	struct rp_ircsm_isupport *isupport);
+
+// split the value of a PREFIX token into its modes and prefixes.
+int rp_ircsm_isupport_prefix(rp_str_t *value, rp_str_t *modes,
+	rp_str_t *prefixes);
 
-int rp_ircsm_parse(struct rp_ircsm_msg *msg, int *state, const char *src,
-	size_t *len);
+// map a verb to its command id.
+int rp_ircsm_verb_lookup(const char *s, size_t len);
 
-int rp_ircsm_msg_init(rp_pool_t *pool, struct rp_ircsm_msg *msg);
+// map a verb or a 3 digit numeric to its command id.
+int rp_ircsm_cmd_lookup(const char *s, size_t len);
 
 #endif // RP_IRC_SM_H
 
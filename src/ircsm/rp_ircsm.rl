@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <rp_scan.h>
 #include <rp_ircsm.h>
 
 %%{
@@ -14,59 +15,67 @@ machine irc;
 action msg_start {
   msg->is_hostmask = 0;
   msg->is_servername = 0;
+  msg->tags.len = 0;
+  msg->prefix.len = 0;
+  msg->hostmask.user.len = 0;
+  msg->hostmask.host.len = 0;
+  msg->params.len = 0;
+  msg->argc = 0;
+  msg->is_trailing = 0;
 }
 
-action prefix_start {
-  msg->prefix.len = 0;
+action parse_error {
+  msg->is_malformed = 1;
+  msg->error_at = (char *)fpc;
 }
 
-action prefix {
-  msg->prefix.ptr[msg->prefix.len++] = fc;
+action tags_start {
+  msg->tags.ptr = (char *)fpc;
 }
 
-action prefix_servername_start {
-  msg->servername.ptr = &msg->prefix.ptr[0];
-  msg->servername.len = 0;
+action tags_finish {
+  msg->tags.len = fpc - msg->tags.ptr;
 }
 
-action prefix_servername {
-  msg->servername.len++;
+action prefix_start {
+  msg->prefix.ptr = (char *)fpc;
 }
 
-action prefix_servername_finish {
-  msg->is_servername = 1;
+action prefix_finish {
+  msg->prefix.len = fpc - msg->prefix.ptr;
 }
 
-action prefix_hostmask_start {
-  msg->hostmask.user.len = 0;
-  msg->hostmask.host.len = 0;
+action prefix_servername_start {
+  msg->servername.ptr = (char *)fpc;
+}
+
+action prefix_servername_finish {
+  msg->servername.len = fpc - msg->servername.ptr;
+  msg->is_servername = 1;
 }
 
 action hostmask_nickname_start {
-  msg->hostmask.nick.len = 0;
-  msg->hostmask.nick.ptr = &msg->prefix.ptr[msg->prefix.len];
+  msg->hostmask.nick.ptr = (char *)fpc;
 }
 
-action hostmask_nickname {
-  msg->hostmask.nick.len++;
+action hostmask_nickname_finish {
+  msg->hostmask.nick.len = fpc - msg->hostmask.nick.ptr;
 }
 
 action hostmask_user_start {
-  msg->hostmask.user.len = 0;
-  msg->hostmask.user.ptr = &msg->prefix.ptr[msg->prefix.len];
+  msg->hostmask.user.ptr = (char *)fpc;
 }
 
-action hostmask_user {
-  msg->hostmask.user.len++;
+action hostmask_user_finish {
+  msg->hostmask.user.len = fpc - msg->hostmask.user.ptr;
 }
 
 action hostmask_host_start {
-  msg->hostmask.host.len = 0;
-  msg->hostmask.host.ptr = &msg->prefix.ptr[msg->prefix.len];
+  msg->hostmask.host.ptr = (char *)fpc;
 }
 
-action hostmask_host {
-  msg->hostmask.host.len++;
+action hostmask_host_finish {
+  msg->hostmask.host.len = fpc - msg->hostmask.host.ptr;
 }
 
 action prefix_hostmask_finish {
@@ -74,42 +83,57 @@ action prefix_hostmask_finish {
 }
 
 action message_code_start {
-  msg->code.len = 0;
+  msg->code.ptr = (char *)fpc;
 }
 
-action message_code {
-  msg->code.ptr[msg->code.len++] = fc;
+action message_code_finish {
+  msg->code.len = fpc - msg->code.ptr;
 }
 
-action message_code_finish {
+action message_code_numeric {
+  msg->cmd = (fpc[-3] - '0') * 100 + (fpc[-2] - '0') * 10 + (fpc[-1] - '0');
 }
 
-action params_start {
-  msg->params.len = 0;
+action message_code_verb {
+  msg->cmd = rp_ircsm_verb_lookup(msg->code.ptr, fpc - msg->code.ptr);
 }
 
-action params {
-  if (!(msg->params.len == 0 && fc == ' ')) {
-    msg->params.ptr[msg->params.len++] = fc;
+# nobody wants the message, stop here and skip to the end of the line
+action message_code_filter {
+  if (msg->interest && !rp_ircsm_interest_test(msg->interest, msg->cmd)) {
+    msg->is_skipped = 1;
+    fbreak;
   }
 }
 
-action params_1_start {
+# params starts on the separating space, the span begins after it
+action params_start {
+  msg->params.ptr = (char *)fpc + 1;
 }
 
-action params_2_start {
+action params_finish {
+  msg->params.len = fpc - msg->params.ptr;
 }
 
-action params_1 {
+action param_start {
+  msg->argv[msg->argc].ptr = (char *)fpc;
 }
 
-action params_2 {
+# the trailing parameter starts on the colon, the span begins after it
+action param_trailing_start {
+  msg->argv[msg->argc].ptr = (char *)fpc + 1;
+  msg->is_trailing = 1;
 }
 
-action params_1_finish {
+# the 15th parameter is trailing even without a colon
+action param_last_start {
+  msg->argv[msg->argc].ptr = (char *)fpc;
+  msg->is_trailing = 1;
 }
 
-action params_2_finish {
+action param_finish {
+  msg->argv[msg->argc].len = fpc - msg->argv[msg->argc].ptr;
+  msg->argc++;
 }
 
 SPACE          = " ";
@@ -127,56 +151,126 @@ ip4addr        = digit{1,3} "." digit{1,3} "." digit{1,3} "." digit{1,3};
 ip6addr        = ( xdigit+ ( ":" xdigit+ ){7} ) | ( "0:0:0:0:0:" ( "0" | "FFFF"i ) ":" ip4addr );
 hostaddr       = ip4addr | ip6addr;
 host           = hostname | hostaddr;
-hostmask       = nickname $ hostmask_nickname > hostmask_nickname_start ( ( "!" user $ hostmask_user > hostmask_user_start )? "@" host $ hostmask_host > hostmask_host_start )?;
-prefix         = ( servername $ prefix_servername > prefix_servername_start % prefix_servername_finish ) | ( hostmask > prefix_hostmask_start % prefix_hostmask_finish );
-code           = alpha+ | digit{3};
+hostmask       = nickname > hostmask_nickname_start % hostmask_nickname_finish ( ( "!" user > hostmask_user_start % hostmask_user_finish )? "@" host > hostmask_host_start % hostmask_host_finish )?;
+prefix         = ( servername > prefix_servername_start % prefix_servername_finish ) | ( hostmask % prefix_hostmask_finish );
+code           = ( alpha+ % message_code_verb ) | ( digit{3} % message_code_numeric );
 middle         = nospcrlfcl ( ":" | nospcrlfcl )*;
 trailing       = ( ":" | " " | nospcrlfcl )*;
-params_1       = ( SPACE middle $ params_1 > params_1_start ){,14} ( SPACE ":"  trailing $ params_1 > params_1_start )?;
-params_2       = ( SPACE middle $ params_2 > params_2_start ){14}  ( SPACE ":"? trailing $ params_2 > params_2_start )?;
-params         = ( params_1 % params_1_finish | params_2 % params_2_finish ) $ params > params_start;
-message        = (( ":" prefix $ prefix > prefix_start SPACE )? ( code $ message_code > message_code_start % message_code_finish ) params? crlf @ { fbreak; }) > msg_start;
-
-main := message;
+tag_key        = ( alnum | "+" | "-" | "." | "/" )+;
+tag_value      = ( extend - ( 0 | "\r" | "\n" | ";" | SPACE ) )*;
+tag            = tag_key ( "=" tag_value )?;
+tags           = tag ( ";" tag )*;
+middle_param   = middle > param_start % param_finish;
+trailing_param = ( ":" > param_trailing_start trailing ) % param_finish;
+last_param     = ( ( nospcrlfcl | SPACE ) trailing ) > param_last_start % param_finish;
+params_1       = ( SPACE middle_param ){,14} ( SPACE trailing_param )?;
+params_2       = ( SPACE middle_param ){14}  ( SPACE ( trailing_param | last_param ) )?;
+params         = ( ( params_1 | params_2 ) - zlen ) > params_start % params_finish;
+message        = (( "@" tags > tags_start % tags_finish SPACE )? ( ":" prefix > prefix_start % prefix_finish SPACE )? ( code > message_code_start % message_code_finish % message_code_filter ) params? crlf @ { fbreak; }) > msg_start;
+
+main := message $! parse_error;
 }%%
 
 int
-rp_ircsm_init(int *state)
-{
-  *state = %%{ write start; }%%;
-
-  return 0;
-}
-
-int
-rp_ircsm_msg_init(rp_pool_t *pool, struct rp_ircsm_msg *msg)
+rp_ircsm_msg_init(struct rp_ircsm_msg *msg)
 {
   memset(msg, 0, sizeof(*msg));
-  msg->prefix.ptr = rp_palloc(pool, 64);
-  msg->code.ptr = rp_palloc(pool, 32);
-  msg->params.ptr = rp_palloc(pool, 512);
 
   return 0;
 }
 
 int
-rp_ircsm_parse(struct rp_ircsm_msg *msg, int *state, const char *src, size_t *len)
+rp_ircsm_parse(struct rp_ircsm_msg *msg, const char *src, size_t *len)
 {
-  int cs = *state;
+  int cs;
   const char *p = src;
-  const char *pe = (const char *)((uintptr_t)p + *len);
+  const char *pe;
+  const char *eof;
+  const char *eol;
+  size_t from = 0;
+
+  // a line that was incomplete before is searched from where the last
+  // call stopped, so a long line coming in piece by piece is not
+  // rescanned from its start every time.
+  if (msg->scan_src == src && msg->scanned <= *len) {
+    from = msg->scanned;
+  }
+
+  // find the end of the line first, the machine only ever runs over
+  // complete lines.
+  if ((eol = rp_scan_crlf(src + from, *len - from)) == NULL) {
+    // the last byte may be the '\r' of a crlf that is cut in half
+    msg->scan_src = src;
+    msg->scanned = *len > 0 ? *len - 1 : 0;
+
+    return RP_IRCSM_AGAIN;
+  }
+
+  msg->scan_src = NULL;
 
-  %%write init nocs;
+  // the line has to be complete once the machine reaches its end
+  pe = eol + 2;
+  eof = pe;
+
+  msg->is_skipped = 0;
+  msg->is_malformed = 0;
+  msg->line.ptr = (char *)src;
+  msg->line.len = (size_t)(pe - src);
+
+  %%write init;
   %%write exec;
 
-  *state = cs;
-  *len = *len - (uintptr_t)(pe - p);
+  *len = msg->line.len;
+
+  if (msg->is_skipped) {
+    return RP_IRCSM_SKIPPED;
+  }
 
   if (cs >= %%{ write first_final; }%%) {
-    *state = %%{ write start; }%%;
-    return 1;
+    return RP_IRCSM_OK;
   }
 
-  return 0;
+  // the grammar rejected the line, skip it as a whole so the next
+  // message starts in a clean state.
+  if (!msg->is_malformed) {
+    msg->is_malformed = 1;
+    msg->error_at = (char *)p;
+  }
+
+  return RP_IRCSM_MALFORMED;
 }
 
+size_t
+rp_ircsm_parse_batch(struct rp_ircsm_msg *msgs, size_t max, const char *src,
+  size_t *len)
+{
+  size_t n = 0;
+  size_t off = 0;
+
+  while (n < max) {
+    size_t l = *len - off;
+    int r = rp_ircsm_parse(&msgs[n], src + off, &l);
+
+    if (r == RP_IRCSM_AGAIN) {
+      // the next call starts with this line, in msgs[0]
+      if (n > 0) {
+        msgs[0].scan_src = msgs[n].scan_src;
+        msgs[0].scanned = msgs[n].scanned;
+        rp_ircsm_scan_reset(&msgs[n]);
+      }
+
+      break;
+    }
+
+    off += l;
+
+    // malformed messages are kept for the fallback handlers
+    if (r != RP_IRCSM_SKIPPED) {
+      n++;
+    }
+  }
+
+  *len = off;
+
+  return n;
+}
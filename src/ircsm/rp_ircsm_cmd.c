@@ -0,0 +1,75 @@
+#include <string.h>
+#include <rp_ircsm.h>
+
+struct rp_ircsm_verb {
+	rp_str_t  name;
+	int       cmd;
+};
+
+// perfect hash over the known verbs, see verb_hash. a new verb has to be
+// placed in a free slot, changing the hash function if it collides.
+#define VERB_TABLE_SZ 64
+
+static const struct rp_ircsm_verb verb_table[VERB_TABLE_SZ] = {
+	[5]  = { rp_string("AWAY"),         RP_IRCSM_CMD_AWAY },
+	[11] = { rp_string("JOIN"),         RP_IRCSM_CMD_JOIN },
+	[14] = { rp_string("ERROR"),        RP_IRCSM_CMD_ERROR },
+	[16] = { rp_string("BATCH"),        RP_IRCSM_CMD_BATCH },
+	[18] = { rp_string("TAGMSG"),       RP_IRCSM_CMD_TAGMSG },
+	[19] = { rp_string("KICK"),         RP_IRCSM_CMD_KICK },
+	[20] = { rp_string("PING"),         RP_IRCSM_CMD_PING },
+	[22] = { rp_string("NICK"),         RP_IRCSM_CMD_NICK },
+	[23] = { rp_string("CAP"),          RP_IRCSM_CMD_CAP },
+	[26] = { rp_string("PONG"),         RP_IRCSM_CMD_PONG },
+	[27] = { rp_string("TOPIC"),        RP_IRCSM_CMD_TOPIC },
+	[31] = { rp_string("ACCOUNT"),      RP_IRCSM_CMD_ACCOUNT },
+	[32] = { rp_string("PRIVMSG"),      RP_IRCSM_CMD_PRIVMSG },
+	[34] = { rp_string("WALLOPS"),      RP_IRCSM_CMD_WALLOPS },
+	[36] = { rp_string("KILL"),         RP_IRCSM_CMD_KILL },
+	[38] = { rp_string("CHGHOST"),      RP_IRCSM_CMD_CHGHOST },
+	[41] = { rp_string("PART"),         RP_IRCSM_CMD_PART },
+	[50] = { rp_string("INVITE"),       RP_IRCSM_CMD_INVITE },
+	[52] = { rp_string("SETNAME"),      RP_IRCSM_CMD_SETNAME },
+	[53] = { rp_string("MODE"),         RP_IRCSM_CMD_MODE },
+	[55] = { rp_string("AUTHENTICATE"), RP_IRCSM_CMD_AUTHENTICATE },
+	[56] = { rp_string("NOTICE"),       RP_IRCSM_CMD_NOTICE },
+	[62] = { rp_string("QUIT"),         RP_IRCSM_CMD_QUIT },
+};
+
+static inline unsigned int
+verb_hash(const u_char *s, size_t len)
+{
+	return (s[0] + s[1] + 17 * s[len - 1] + len) & (VERB_TABLE_SZ - 1);
+}
+
+int
+rp_ircsm_verb_lookup(const char *s, size_t len)
+{
+	const struct rp_ircsm_verb *v;
+
+	// every known verb has at least three letters
+	if (len < 3) {
+		return RP_IRCSM_CMD_UNKNOWN;
+	}
+
+	v = &verb_table[verb_hash((const u_char *)s, len)];
+
+	if (v->name.len != len || memcmp(v->name.ptr, s, len) != 0) {
+		return RP_IRCSM_CMD_UNKNOWN;
+	}
+
+	return v->cmd;
+}
+
+int
+rp_ircsm_cmd_lookup(const char *s, size_t len)
+{
+	if (len == 3 &&
+	    s[0] >= '0' && s[0] <= '9' &&
+	    s[1] >= '0' && s[1] <= '9' &&
+	    s[2] >= '0' && s[2] <= '9') {
+		return (s[0] - '0') * 100 + (s[1] - '0') * 10 + (s[2] - '0');
+	}
+
+	return rp_ircsm_verb_lookup(s, len);
+}
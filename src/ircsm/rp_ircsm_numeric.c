@@ -0,0 +1,155 @@
+#include <string.h>
+#include <rp_ircsm.h>
+
+// membership prefixes when the server did not send PREFIX in 005
+#define DEFAULT_PREFIXES "~&@%+"
+
+int
+rp_ircsm_names_decode(struct rp_ircsm_msg *msg, const char *prefixes,
+	struct rp_ircsm_names *names)
+{
+	// <me> <type> <channel> :<names>
+	if (msg->cmd != 353 || msg->argc != 4 || msg->argv[1].len != 1) {
+		return -1;
+	}
+
+	if (prefixes == NULL) {
+		prefixes = DEFAULT_PREFIXES;
+	}
+
+	names->type = msg->argv[1].ptr[0];
+	names->channel = msg->argv[2];
+	names->count = 0;
+
+	char *p = msg->argv[3].ptr;
+	char *end = p + msg->argv[3].len;
+
+	while (p < end && names->count < RP_IRCSM_MAX_NAMES) {
+		struct rp_ircsm_name *name;
+		char *start;
+
+		if (*p == ' ') {
+			p++;
+			continue;
+		}
+
+		name = &names->names[names->count++];
+
+		start = p;
+		while (p < end && *p != '\0' && strchr(prefixes, *p) != NULL) {
+			p++;
+		}
+
+		name->prefix.ptr = start;
+		name->prefix.len = p - start;
+
+		start = p;
+		while (p < end && *p != ' ') {
+			p++;
+		}
+
+		name->nick.ptr = start;
+		name->nick.len = p - start;
+	}
+
+	return 0;
+}
+
+int
+rp_ircsm_who_decode(struct rp_ircsm_msg *msg, struct rp_ircsm_who *who)
+{
+	// <me> <channel> <user> <host> <server> <nick> <flags> :<hops> <realname>
+	if (msg->cmd != 352 || msg->argc != 8) {
+		return -1;
+	}
+
+	who->channel = msg->argv[1];
+	who->user = msg->argv[2];
+	who->host = msg->argv[3];
+	who->server = msg->argv[4];
+	who->nick = msg->argv[5];
+	who->flags = msg->argv[6];
+
+	who->is_away = who->flags.len > 0 && who->flags.ptr[0] == 'G';
+	who->is_oper = who->flags.len > 1 && who->flags.ptr[1] == '*';
+
+	char *p = msg->argv[7].ptr;
+	char *end = p + msg->argv[7].len;
+
+	who->hopcount = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		who->hopcount = who->hopcount * 10 + (*p++ - '0');
+	}
+
+	if (p < end && *p == ' ') {
+		p++;
+	}
+
+	who->realname.ptr = p;
+	who->realname.len = end - p;
+
+	return 0;
+}
+
+int
+rp_ircsm_isupport_decode(struct rp_ircsm_msg *msg,
+	struct rp_ircsm_isupport *isupport)
+{
+	unsigned int i;
+
+	// <me> <token>... :are supported by this server
+	if (msg->cmd != 5 || msg->argc < 2) {
+		return -1;
+	}
+
+	isupport->count = 0;
+
+	// the trailing text is not a token, but some servers leave it out
+	for (i = 1; i < msg->argc - msg->is_trailing; i++) {
+		struct rp_ircsm_isupport_token *t;
+		rp_str_t *arg = &msg->argv[i];
+		char *eq;
+
+		if (arg->len == 0) {
+			continue;
+		}
+
+		t = &isupport->tokens[isupport->count++];
+		t->is_negated = arg->ptr[0] == '-';
+		t->key.ptr = arg->ptr + t->is_negated;
+		t->key.len = arg->len - t->is_negated;
+		t->value.len = 0;
+		t->value.ptr = NULL;
+
+		if ((eq = memchr(t->key.ptr, '=', t->key.len)) != NULL) {
+			t->value.ptr = eq + 1;
+			t->value.len = t->key.len - (eq + 1 - t->key.ptr);
+			t->key.len = eq - t->key.ptr;
+		}
+	}
+
+	return 0;
+}
+
+int
+rp_ircsm_isupport_prefix(rp_str_t *value, rp_str_t *modes, rp_str_t *prefixes)
+{
+	char *close;
+
+	// (modes)prefixes, with one prefix per mode
+	if (value->len < 2 || value->ptr[0] != '(' ||
+	    (close = memchr(value->ptr, ')', value->len)) == NULL) {
+		return -1;
+	}
+
+	modes->ptr = value->ptr + 1;
+	modes->len = close - modes->ptr;
+	prefixes->ptr = close + 1;
+	prefixes->len = value->len - (prefixes->ptr - value->ptr);
+
+	if (modes->len != prefixes->len) {
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include <string.h>
+#include <rp_ircsm.h>
+
+// unescape a tag value into buf, returns the unescaped length.
+static size_t
+tag_unescape(const char *p, size_t len, char *buf, size_t size)
+{
+	const char *end = p + len;
+	size_t n = 0;
+
+	while (p < end && n < size) {
+		char c = *p++;
+
+		if (c == '\\') {
+			// a lone backslash at the end is dropped
+			if (p == end) {
+				break;
+			}
+
+			switch ((c = *p++)) {
+			case ':':
+				c = ';';
+				break;
+			case 's':
+				c = ' ';
+				break;
+			case 'r':
+				c = '\r';
+				break;
+			case 'n':
+				c = '\n';
+				break;
+			default:
+				// "\\" and unknown escapes map to the character
+				break;
+			}
+		}
+
+		buf[n++] = c;
+	}
+
+	return n;
+}
+
+int
+rp_ircsm_tag_get(struct rp_ircsm_msg *msg, const char *key,
+	rp_str_t *value, char *buf, size_t size)
+{
+	const char *p = msg->tags.ptr;
+	const char *end = p + msg->tags.len;
+	size_t key_len = strlen(key);
+
+	while (p < end) {
+		const char *tag_end = memchr(p, ';', end - p);
+
+		if (tag_end == NULL) {
+			tag_end = end;
+		}
+
+		size_t n = tag_end - p;
+
+		if (n >= key_len && memcmp(p, key, key_len) == 0 &&
+		    (n == key_len || p[key_len] == '=')) {
+			const char *v = p + key_len + (n > key_len ? 1 : 0);
+			size_t v_len = tag_end - v;
+
+			if (memchr(v, '\\', v_len) == NULL) {
+				// nothing to unescape, point into the message
+				value->ptr = (char *)v;
+				value->len = v_len;
+			} else {
+				value->ptr = buf;
+				value->len = tag_unescape(v, v_len, buf, size);
+			}
+
+			return 1;
+		}
+
+		p = tag_end + 1;
+	}
+
+	return 0;
+}
@@ -2,7 +2,10 @@ sp             := $(sp).x
 dirstack_$(sp) := $(d)
 d              := $(dir)
 
-OBJS_$(d) := $(d)/rp_ircsm.o
+OBJS_$(d) := $(d)/rp_ircsm.o \
+             $(d)/rp_ircsm_cmd.o \
+             $(d)/rp_ircsm_numeric.o \
+             $(d)/rp_ircsm_tag.o
 
 $(d)/rp_ircsm.c: $(d)/rp_ircsm.rl
 
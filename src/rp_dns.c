@@ -0,0 +1,1036 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+#include <rpbot.h>
+#include <rp_event.h>
+#include <rp_dns.h>
+#include <rp_math.h>
+#include <uthash.h>
+#include <utlist.h>
+
+#define DNS_PORT        53
+#define DNS_MAX_SERVERS 3 // MAXNS of resolv.conf
+#define DNS_TIMEOUT     (2 * 1000)
+#define DNS_ATTEMPTS    2 // per nameserver
+#define DNS_UDP_SIZE    1232 // advertised with edns0
+#define DNS_TCP_SIZE    (2 + 65535) // length prefix and the largest message
+#define DNS_MAX_TTL     (24 * 60 * 60)
+#define DNS_HDR_SZ      12
+
+#define DNS_T_A    1
+#define DNS_T_AAAA 28
+#define DNS_T_OPT  41
+#define DNS_C_IN   1
+
+#define DNS_RCODE_NXDOMAIN 3
+
+// the record types asked for, ipv6 first to keep the order of the result
+enum {
+	DNS_Q_AAAA = 0,
+	DNS_Q_A,
+	DNS_Q_N,
+};
+
+static const uint16_t dns_qtypes[DNS_Q_N] = { DNS_T_AAAA, DNS_T_A };
+
+// what an answer did to a query
+enum {
+	DNS_IGNORED = 0, // not for us or malformed
+	DNS_ANSWERED,
+	DNS_TRUNCATED,
+	DNS_NXDOMAIN,
+	DNS_SERVFAIL,
+};
+
+// the addresses of a name, from /etc/hosts or an answer.
+struct rp_dns_entry {
+	char               name[RP_DNS_MAX_NAME + 1];
+	time_t             expires; // wall clock, so it survives a restart
+	size_t             n_addrs;
+	struct rp_dns_addr addrs[RP_DNS_MAX_ADDRS];
+	UT_hash_handle     hh;
+};
+
+struct rp_dns_query {
+	struct rp_dns_ctx *dns;
+	char               name[RP_DNS_MAX_NAME + 1];
+	rp_dns_handler_t   handler;
+	void              *data;
+
+	int                fd;
+	unsigned           server; // index of the nameserver asked
+	unsigned           tries;
+	rp_timer_t         timer;
+
+	// the name in wire format, both questions share it
+	u_char             qname[RP_DNS_MAX_NAME + 2];
+	size_t             qname_len;
+
+	uint16_t           ids[DNS_Q_N];
+	unsigned           pending; // bit per type that was not answered
+	unsigned int       tcp:1; // an answer was truncated
+	unsigned int       sent:1; // the tcp questions are written
+
+	uint32_t           ttl; // the lowest of the records
+	size_t             n_addrs[DNS_Q_N];
+	struct rp_dns_addr addrs[DNS_Q_N][RP_DNS_MAX_ADDRS];
+
+	// the tcp stream, answers are length prefixed
+	u_char            *buf;
+	size_t             len;
+
+	struct rp_dns_query *prev;
+	struct rp_dns_query *next;
+};
+
+struct rp_dns_ctx {
+	rp_pool_t           *pool;
+	struct rp_event_ctx *ev;
+
+	struct rp_dns_addr   servers[DNS_MAX_SERVERS];
+	unsigned             n_servers;
+	unsigned int         servers_set:1; // given by rp_dns_nameserver
+
+	struct rp_dns_entry *hosts;
+	struct rp_dns_entry *cache;
+	const char          *cache_path;
+
+	struct rp_dns_query *queries; // running
+	struct rp_dns_query *free; // done, kept for reuse
+};
+
+int
+rp_dns_addr_parse(struct rp_dns_addr *addr, const char *str)
+{
+	memset(addr, 0, sizeof(*addr));
+
+	if (inet_pton(AF_INET6, str, &addr->u.in6.sin6_addr) == 1) {
+		addr->u.in6.sin6_family = AF_INET6;
+		addr->len = sizeof(addr->u.in6);
+		return 0;
+	}
+
+	if (inet_pton(AF_INET, str, &addr->u.in.sin_addr) == 1) {
+		addr->u.in.sin_family = AF_INET;
+		addr->len = sizeof(addr->u.in);
+		return 0;
+	}
+
+	return -1;
+}
+
+static void
+addr_set_port(struct rp_dns_addr *addr, uint16_t port)
+{
+	if (addr->u.sa.sa_family == AF_INET6) {
+		addr->u.in6.sin6_port = htons(port);
+	} else {
+		addr->u.in.sin_port = htons(port);
+	}
+}
+
+static const char *
+addr_str(const struct rp_dns_addr *addr, char *buf, size_t len)
+{
+	const void *a = addr->u.sa.sa_family == AF_INET6
+	              ? (const void *)&addr->u.in6.sin6_addr
+	              : (const void *)&addr->u.in.sin_addr;
+
+	return inet_ntop(addr->u.sa.sa_family, a, buf, len);
+}
+
+// lowercase the name and drop the root label, returns -1 if it is not a
+// valid name.
+static int
+dns_name(char *dst, const char *name)
+{
+	size_t len = strlen(name);
+	size_t i;
+
+	if (len > 0 && name[len - 1] == '.') {
+		len--;
+	}
+
+	if (len == 0 || len > RP_DNS_MAX_NAME) {
+		return -1;
+	}
+
+	for (i = 0; i < len; i++) {
+		dst[i] = tolower((unsigned char)name[i]);
+	}
+
+	dst[len] = '\0';
+
+	return 0;
+}
+
+// encode a name as labels, returns the length or 0 if a label is empty
+// or too long.
+static size_t
+dns_qname(u_char *p, const char *name)
+{
+	size_t len = 0;
+
+	while (*name) {
+		const char *dot = strchr(name, '.');
+		size_t n = dot ? (size_t)(dot - name) : strlen(name);
+
+		if (n == 0 || n > 63) {
+			return 0;
+		}
+
+		p[len++] = (u_char)n;
+		memcpy(p + len, name, n);
+		len += n;
+		name += dot ? n + 1 : n;
+	}
+
+	p[len++] = 0;
+
+	return len;
+}
+
+// add an address to an entry, ipv6 ones before ipv4 ones.
+static void
+entry_add(struct rp_dns_entry *e, const struct rp_dns_addr *addr)
+{
+	size_t i = e->n_addrs;
+
+	if (e->n_addrs == RP_DNS_MAX_ADDRS) {
+		return;
+	}
+
+	if (addr->u.sa.sa_family == AF_INET6) {
+		while (i > 0 && e->addrs[i - 1].u.sa.sa_family != AF_INET6) {
+			e->addrs[i] = e->addrs[i - 1];
+			i--;
+		}
+	}
+
+	e->addrs[i] = *addr;
+	e->n_addrs++;
+}
+
+static struct rp_dns_entry *
+entry_get(struct rp_dns_ctx *dns, struct rp_dns_entry **table,
+	const char *name)
+{
+	struct rp_dns_entry *e;
+
+	HASH_FIND_STR(*table, name, e);
+
+	if (e) {
+		return e;
+	}
+
+	if ((e = rp_pcalloc(dns->pool, sizeof(*e))) == NULL) {
+		return NULL;
+	}
+
+	strcpy(e->name, name);
+	HASH_ADD_STR(*table, name, e);
+
+	return e;
+}
+
+static void
+load_hosts(struct rp_dns_ctx *dns)
+{
+	FILE *f = fopen("/etc/hosts", "r");
+	char *line = NULL, *save, *tok, *hash;
+	size_t cap = 0;
+
+	if (!f) {
+		return;
+	}
+
+	while (getline(&line, &cap, f) != -1) {
+		struct rp_dns_addr addr;
+		char name[RP_DNS_MAX_NAME + 1];
+
+		if ((hash = strchr(line, '#')) != NULL) {
+			*hash = '\0';
+		}
+
+		if ((tok = strtok_r(line, " \t\r\n", &save)) == NULL ||
+		    rp_dns_addr_parse(&addr, tok)) {
+			continue;
+		}
+
+		while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+			struct rp_dns_entry *e;
+
+			if (dns_name(name, tok) == 0 &&
+			    (e = entry_get(dns, &dns->hosts, name)) != NULL) {
+				entry_add(e, &addr);
+			}
+		}
+	}
+
+	free(line);
+	fclose(f);
+}
+
+static void
+load_resolv_conf(struct rp_dns_ctx *dns)
+{
+	FILE *f = fopen("/etc/resolv.conf", "r");
+	char *line = NULL, *save, *tok;
+	size_t cap = 0;
+
+	if (f) {
+		while (getline(&line, &cap, f) != -1 &&
+		       dns->n_servers < DNS_MAX_SERVERS) {
+			struct rp_dns_addr *addr = &dns->servers[dns->n_servers];
+
+			if ((tok = strtok_r(line, " \t\r\n", &save)) == NULL ||
+			    strcmp(tok, "nameserver") != 0 ||
+			    (tok = strtok_r(NULL, " \t\r\n", &save)) == NULL ||
+			    rp_dns_addr_parse(addr, tok)) {
+				continue;
+			}
+
+			addr_set_port(addr, DNS_PORT);
+			dns->n_servers++;
+		}
+
+		free(line);
+		fclose(f);
+	}
+
+	// the local server is asked without a config, like libc does
+	if (dns->n_servers == 0) {
+		rp_dns_addr_parse(&dns->servers[0], "127.0.0.1");
+		addr_set_port(&dns->servers[0], DNS_PORT);
+		dns->n_servers = 1;
+	}
+}
+
+int
+rp_dns_init(rp_pool_t *pool, struct rp_event_ctx *ev, struct rp_dns_ctx **dns)
+{
+	struct rp_dns_ctx *d;
+
+	if ((d = rp_pcalloc(pool, sizeof(*d))) == NULL) {
+		return -1;
+	}
+
+	d->pool = pool;
+	d->ev = ev;
+
+	load_hosts(d);
+	load_resolv_conf(d);
+
+	*dns = d;
+
+	return 0;
+}
+
+int
+rp_dns_nameserver(struct rp_dns_ctx *dns, const char *spec)
+{
+	struct rp_dns_addr addr;
+	char buf[INET6_ADDRSTRLEN + 8];
+	char *port;
+	unsigned long p = DNS_PORT;
+
+	if (strlen(spec) >= sizeof(buf)) {
+		return -1;
+	}
+
+	strcpy(buf, spec);
+
+	if ((port = strchr(buf, '#')) != NULL) {
+		*port++ = '\0';
+		p = strtoul(port, NULL, 10);
+	}
+
+	if (rp_dns_addr_parse(&addr, buf) || p == 0 || p > UINT16_MAX) {
+		return -1;
+	}
+
+	// the first server given replaces the ones from resolv.conf
+	if (!dns->servers_set) {
+		dns->servers_set = 1;
+		dns->n_servers = 0;
+	}
+
+	if (dns->n_servers == DNS_MAX_SERVERS) {
+		return -1;
+	}
+
+	addr_set_port(&addr, (uint16_t)p);
+	dns->servers[dns->n_servers++] = addr;
+
+	return 0;
+}
+
+// the file has a line per name: the name, the unix time it expires and
+// its addresses.
+static int
+cache_load(struct rp_dns_ctx *dns)
+{
+	FILE *f = fopen(dns->cache_path, "r");
+	char *line = NULL, *save, *tok;
+	size_t cap = 0;
+
+	if (!f) {
+		return errno == ENOENT ? 0 : -1;
+	}
+
+	while (getline(&line, &cap, f) != -1) {
+		struct rp_dns_entry *e;
+		char name[RP_DNS_MAX_NAME + 1];
+		time_t expires;
+
+		if ((tok = strtok_r(line, " \t\r\n", &save)) == NULL ||
+		    tok[0] == '#' || dns_name(name, tok)) {
+			continue;
+		}
+
+		if ((tok = strtok_r(NULL, " \t\r\n", &save)) == NULL) {
+			continue;
+		}
+
+		expires = (time_t)strtoll(tok, NULL, 10);
+
+		if ((e = entry_get(dns, &dns->cache, name)) == NULL) {
+			break;
+		}
+
+		e->expires = expires;
+		e->n_addrs = 0;
+
+		while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+			struct rp_dns_addr addr;
+
+			if (rp_dns_addr_parse(&addr, tok) == 0) {
+				entry_add(e, &addr);
+			}
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	return 0;
+}
+
+// write the cache to a temporary file and move it over the old one, so
+// a crash never leaves half a file behind.
+static int
+cache_save(struct rp_dns_ctx *dns)
+{
+	struct rp_dns_entry *e, *tmp;
+	char path[PATH_MAX];
+	FILE *f;
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s.XXXXXX", dns->cache_path)
+	    >= (int)sizeof(path)) {
+		return -1;
+	}
+
+	if ((fd = mkstemp(path)) == -1 || (f = fdopen(fd, "w")) == NULL) {
+		perror("cache_save");
+
+		if (fd != -1) {
+			close(fd);
+			unlink(path);
+		}
+
+		return -1;
+	}
+
+	fprintf(f, "# name expires addresses...\n");
+
+	HASH_ITER(hh, dns->cache, e, tmp) {
+		char buf[INET6_ADDRSTRLEN];
+		size_t i;
+
+		if (e->n_addrs == 0) {
+			continue;
+		}
+
+		fprintf(f, "%s %lld", e->name, (long long)e->expires);
+
+		for (i = 0; i < e->n_addrs; i++) {
+			if (addr_str(&e->addrs[i], buf, sizeof(buf))) {
+				fprintf(f, " %s", buf);
+			}
+		}
+
+		fprintf(f, "\n");
+	}
+
+	if (fclose(f) != 0 || rename(path, dns->cache_path) != 0) {
+		perror("cache_save");
+		unlink(path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+rp_dns_cache_file(struct rp_dns_ctx *dns, const char *path)
+{
+	dns->cache_path = path;
+
+	return cache_load(dns);
+}
+
+static void dns_timer_handler(rp_timer_t *timer);
+static void handle_dns_event(struct rp_event_ctx *ctx, int fd,
+	unsigned events, void *udata);
+
+static void
+dns_close(struct rp_dns_query *q)
+{
+	if (q->fd != -1) {
+		rp_event_del(q->dns->ev, q->fd);
+		close(q->fd);
+		q->fd = -1;
+	}
+}
+
+static void
+dns_release(struct rp_dns_query *q)
+{
+	struct rp_dns_ctx *dns = q->dns;
+
+	dns_close(q);
+	rp_timer_del(rp_event_timers(dns->ev), &q->timer);
+
+	if (q->buf) {
+		rp_free(q->buf);
+		q->buf = NULL;
+	}
+
+	DL_DELETE(dns->queries, q);
+	LL_PREPEND(dns->free, q);
+}
+
+// a question for type t with an edns0 record for larger udp answers,
+// returns its length.
+static size_t
+dns_question(struct rp_dns_query *q, unsigned t, u_char *p)
+{
+	size_t len = 0;
+
+	p[len++] = q->ids[t] >> 8;
+	p[len++] = q->ids[t] & 0xff;
+	p[len++] = 0x01; // recursion desired
+	p[len++] = 0x00;
+	p[len++] = 0; p[len++] = 1; // questions
+	p[len++] = 0; p[len++] = 0; // answers
+	p[len++] = 0; p[len++] = 0; // authority
+	p[len++] = 0; p[len++] = 1; // additional
+
+	memcpy(p + len, q->qname, q->qname_len);
+	len += q->qname_len;
+
+	p[len++] = dns_qtypes[t] >> 8;
+	p[len++] = dns_qtypes[t] & 0xff;
+	p[len++] = 0;
+	p[len++] = DNS_C_IN;
+
+	// opt: root name, type, udp size in the class, no flags and data
+	p[len++] = 0;
+	p[len++] = 0;
+	p[len++] = DNS_T_OPT;
+	p[len++] = DNS_UDP_SIZE >> 8;
+	p[len++] = DNS_UDP_SIZE & 0xff;
+	memset(p + len, 0, 6);
+	len += 6;
+
+	return len;
+}
+
+// send the questions that are still open, each with a fresh id.
+static int
+dns_send(struct rp_dns_query *q)
+{
+	u_char buf[2 * (2 + DNS_HDR_SZ + RP_DNS_MAX_NAME + 2 + 4 + 11)];
+	size_t len = 0;
+	unsigned t;
+
+	for (t = 0; t < DNS_Q_N; t++) {
+		size_t n;
+
+		if (!(q->pending & (1u << t))) {
+			continue;
+		}
+
+		if (getrandom(&q->ids[t], sizeof(q->ids[t]), GRND_NONBLOCK)
+		    != sizeof(q->ids[t])) {
+			q->ids[t] = (uint16_t)rand();
+		}
+
+		if (!q->tcp) {
+			n = dns_question(q, t, buf);
+
+			if (send(q->fd, buf, n, 0) != (ssize_t)n) {
+				return -1;
+			}
+
+			continue;
+		}
+
+		n = dns_question(q, t, buf + len + 2);
+		buf[len] = n >> 8;
+		buf[len + 1] = n & 0xff;
+		len += n + 2;
+	}
+
+	// the socket buffer of a new connection takes both at once
+	if (q->tcp && write(q->fd, buf, len) != (ssize_t)len) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// open a socket to the current nameserver, the udp questions go out
+// right away, the tcp ones once it is connected.
+static int
+dns_open(struct rp_dns_query *q)
+{
+	struct rp_dns_ctx *dns = q->dns;
+	struct rp_dns_addr *server = &dns->servers[q->server];
+	int type = q->tcp ? SOCK_STREAM : SOCK_DGRAM;
+
+	dns_close(q);
+
+	// a new socket for every attempt gets a new source port as well
+	q->fd = socket(server->u.sa.sa_family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (q->fd == -1) {
+		return -1;
+	}
+
+	if (connect(q->fd, &server->u.sa, server->len) == -1 &&
+	    errno != EINPROGRESS) {
+		return -1;
+	}
+
+	q->sent = 0;
+	q->len = 0;
+
+	if (rp_event_add(dns->ev, q->fd,
+	                 q->tcp ? RP_EVENT_READ | RP_EVENT_WRITE : RP_EVENT_READ,
+	                 handle_dns_event, q)) {
+		close(q->fd);
+		q->fd = -1;
+		return -1;
+	}
+
+	rp_timer_add(rp_event_timers(dns->ev), &q->timer,
+	             rp_current_msec + DNS_TIMEOUT);
+
+	if (!q->tcp) {
+		q->sent = 1;
+		return dns_send(q);
+	}
+
+	return 0;
+}
+
+// hand the result to the caller, stale cache entries stand in when no
+// nameserver answered.
+static void
+dns_finish(struct rp_dns_query *q, int failed)
+{
+	struct rp_dns_ctx *dns = q->dns;
+	struct rp_dns_entry result, *e;
+	rp_dns_handler_t handler = q->handler;
+	void *data = q->data;
+	unsigned t;
+	size_t i;
+
+	result.n_addrs = 0;
+
+	for (t = 0; t < DNS_Q_N; t++) {
+		for (i = 0; i < q->n_addrs[t]; i++) {
+			entry_add(&result, &q->addrs[t][i]);
+		}
+	}
+
+	HASH_FIND_STR(dns->cache, q->name, e);
+
+	if (result.n_addrs > 0) {
+		if ((e = entry_get(dns, &dns->cache, q->name)) != NULL) {
+			e->expires = time(NULL) + rp_min(q->ttl, (uint32_t)DNS_MAX_TTL);
+			e->n_addrs = result.n_addrs;
+			memcpy(e->addrs, result.addrs, result.n_addrs * sizeof(result.addrs[0]));
+
+			if (dns->cache_path) {
+				cache_save(dns);
+			}
+		}
+	} else if (failed && e && e->n_addrs > 0) {
+		fprintf(stderr, "no nameserver answered for %s, using the cache\n",
+		        q->name);
+
+		result.n_addrs = e->n_addrs;
+		memcpy(result.addrs, e->addrs, e->n_addrs * sizeof(e->addrs[0]));
+	}
+
+	dns_release(q);
+	handler(data, result.addrs, result.n_addrs);
+}
+
+// try the next nameserver, or give up once every one was asked often
+// enough.
+static void
+dns_retry(struct rp_dns_query *q)
+{
+	struct rp_dns_ctx *dns = q->dns;
+
+	while (++q->tries < dns->n_servers * DNS_ATTEMPTS) {
+		q->server = q->tries % dns->n_servers;
+
+		if (dns_open(q) == 0) {
+			return;
+		}
+	}
+
+	dns_finish(q, 1);
+}
+
+static void
+dns_timer_handler(rp_timer_t *timer)
+{
+	dns_retry(timer->data);
+}
+
+// skip a possibly compressed name, returns the offset after it or 0.
+static size_t
+skip_name(const u_char *p, size_t n, size_t off)
+{
+	while (off < n) {
+		unsigned len = p[off];
+
+		if (len == 0) {
+			return off + 1;
+		}
+
+		if ((len & 0xc0) == 0xc0) {
+			return off + 2 <= n ? off + 2 : 0;
+		}
+
+		if (len & 0xc0) {
+			return 0;
+		}
+
+		off += len + 1;
+	}
+
+	return 0;
+}
+
+static int
+dns_parse(struct rp_dns_query *q, const u_char *p, size_t n)
+{
+	size_t off, i, an;
+	unsigned t;
+	uint16_t id;
+
+	if (n < DNS_HDR_SZ || !(p[2] & 0x80)) {
+		return DNS_IGNORED;
+	}
+
+	id = (uint16_t)(p[0] << 8 | p[1]);
+
+	for (t = 0; t < DNS_Q_N; t++) {
+		if ((q->pending & (1u << t)) && q->ids[t] == id) {
+			break;
+		}
+	}
+
+	// the question has to be ours, in any case
+	off = DNS_HDR_SZ + q->qname_len;
+
+	if (t == DNS_Q_N || p[4] != 0 || p[5] != 1 || off + 4 > n ||
+	    p[off] != dns_qtypes[t] >> 8 || p[off + 1] != (dns_qtypes[t] & 0xff)) {
+		return DNS_IGNORED;
+	}
+
+	for (i = 0; i < q->qname_len; i++) {
+		if (tolower(p[DNS_HDR_SZ + i]) != q->qname[i]) {
+			return DNS_IGNORED;
+		}
+	}
+
+	if (p[2] & 0x02) {
+		return DNS_TRUNCATED;
+	}
+
+	switch (p[3] & 0x0f) {
+	case 0:
+		break;
+	case DNS_RCODE_NXDOMAIN:
+		return DNS_NXDOMAIN;
+	default:
+		return DNS_SERVFAIL;
+	}
+
+	an = (size_t)(p[6] << 8 | p[7]);
+	off += 4;
+
+	// cnames are followed by the server, the addresses of the chain are
+	// in the same answer.
+	for (i = 0; i < an; i++) {
+		unsigned type, class, len;
+		uint32_t ttl;
+
+		if ((off = skip_name(p, n, off)) == 0 || off + 10 > n) {
+			break;
+		}
+
+		type = p[off] << 8 | p[off + 1];
+		class = p[off + 2] << 8 | p[off + 3];
+		ttl = (uint32_t)p[off + 4] << 24 | (uint32_t)p[off + 5] << 16 |
+		      (uint32_t)p[off + 6] << 8 | p[off + 7];
+		len = p[off + 8] << 8 | p[off + 9];
+		off += 10;
+
+		if (off + len > n) {
+			break;
+		}
+
+		if (class == DNS_C_IN && type == dns_qtypes[t] &&
+		    q->n_addrs[t] < RP_DNS_MAX_ADDRS) {
+			struct rp_dns_addr *addr = &q->addrs[t][q->n_addrs[t]];
+
+			memset(addr, 0, sizeof(*addr));
+
+			if (type == DNS_T_A && len == 4) {
+				addr->u.in.sin_family = AF_INET;
+				addr->len = sizeof(addr->u.in);
+				memcpy(&addr->u.in.sin_addr, p + off, 4);
+				q->n_addrs[t]++;
+			} else if (type == DNS_T_AAAA && len == 16) {
+				addr->u.in6.sin6_family = AF_INET6;
+				addr->len = sizeof(addr->u.in6);
+				memcpy(&addr->u.in6.sin6_addr, p + off, 16);
+				q->n_addrs[t]++;
+			}
+
+			q->ttl = rp_min(q->ttl, ttl & 0x7fffffff);
+		}
+
+		off += len;
+	}
+
+	q->pending &= ~(1u << t);
+
+	return DNS_ANSWERED;
+}
+
+// handle an answer, returns 1 if the query is done or went on to another
+// socket.
+static int
+dns_answer(struct rp_dns_query *q, const u_char *p, size_t n)
+{
+	switch (dns_parse(q, p, n)) {
+	case DNS_ANSWERED:
+		if (q->pending == 0) {
+			dns_finish(q, 0);
+			return 1;
+		}
+
+		return 0;
+	case DNS_TRUNCATED:
+		if (q->tcp) {
+			dns_retry(q);
+			return 1;
+		}
+
+		// ask the same server again over tcp
+		q->tcp = 1;
+
+		if (dns_open(q)) {
+			dns_retry(q);
+		}
+
+		return 1;
+	case DNS_NXDOMAIN:
+		// the name does not exist for any type
+		q->pending = 0;
+		memset(q->n_addrs, 0, sizeof(q->n_addrs));
+		dns_finish(q, 0);
+		return 1;
+	case DNS_SERVFAIL:
+		dns_retry(q);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// read the answers from a tcp stream, returns 1 if the query is done or
+// went on to another socket.
+static int
+dns_read_tcp(struct rp_dns_query *q)
+{
+	ssize_t n;
+
+	if (!q->buf && (q->buf = rp_alloc(DNS_TCP_SIZE)) == NULL) {
+		dns_retry(q);
+		return 1;
+	}
+
+	while ((n = read(q->fd, q->buf + q->len, DNS_TCP_SIZE - q->len)) > 0) {
+		q->len += n;
+
+		while (q->len >= 2) {
+			size_t len = (size_t)(q->buf[0] << 8 | q->buf[1]);
+
+			if (q->len < len + 2) {
+				break;
+			}
+
+			if (dns_answer(q, q->buf + 2, len)) {
+				return 1;
+			}
+
+			q->len -= len + 2;
+			memmove(q->buf, q->buf + len + 2, q->len);
+		}
+	}
+
+	if (n == 0 || errno != EAGAIN) {
+		// the server hung up before it answered everything
+		dns_retry(q);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void
+handle_dns_event(struct rp_event_ctx *ctx, int fd, unsigned events,
+	void *udata)
+{
+	struct rp_dns_query *q = udata;
+
+	if (q->tcp && !q->sent && (events & RP_EVENT_WRITE) &&
+	    !(events & RP_EVENT_ERROR)) {
+		q->sent = 1;
+		rp_event_mod(ctx, fd, RP_EVENT_READ);
+
+		if (dns_send(q)) {
+			dns_retry(q);
+			return;
+		}
+	}
+
+	if (events & RP_EVENT_READ) {
+		if (q->tcp) {
+			if (dns_read_tcp(q)) {
+				return;
+			}
+		} else {
+			u_char buf[DNS_UDP_SIZE];
+			ssize_t n;
+
+			while ((n = recv(fd, buf, sizeof(buf), 0)) >= 0) {
+				if (dns_answer(q, buf, (size_t)n)) {
+					return;
+				}
+			}
+		}
+	}
+
+	// refused or unreachable, no need to wait for the timeout
+	if (events & RP_EVENT_ERROR) {
+		dns_retry(q);
+	}
+}
+
+int
+rp_dns_resolve(struct rp_dns_ctx *dns, const char *name,
+	rp_dns_handler_t handler, void *data, struct rp_dns_query **query)
+{
+	struct rp_dns_addr addr;
+	struct rp_dns_entry *e;
+	struct rp_dns_query *q;
+	char key[RP_DNS_MAX_NAME + 1];
+
+	*query = NULL;
+
+	if (rp_dns_addr_parse(&addr, name) == 0) {
+		handler(data, &addr, 1);
+		return 0;
+	}
+
+	if (dns_name(key, name)) {
+		return -1;
+	}
+
+	HASH_FIND_STR(dns->hosts, key, e);
+
+	if (!e) {
+		HASH_FIND_STR(dns->cache, key, e);
+
+		if (e && (e->n_addrs == 0 || e->expires <= time(NULL))) {
+			e = NULL;
+		}
+	}
+
+	if (e) {
+		handler(data, e->addrs, e->n_addrs);
+		return 0;
+	}
+
+	if (dns->free) {
+		q = dns->free;
+		LL_DELETE(dns->free, q);
+	} else if ((q = rp_palloc(dns->pool, sizeof(*q))) == NULL) {
+		return -1;
+	}
+
+	memset(q, 0, sizeof(*q));
+
+	if ((q->qname_len = dns_qname(q->qname, key)) == 0) {
+		LL_PREPEND(dns->free, q);
+		return -1;
+	}
+
+	strcpy(q->name, key);
+	q->dns = dns;
+	q->handler = handler;
+	q->data = data;
+	q->fd = -1;
+	q->pending = (1u << DNS_Q_N) - 1;
+	q->ttl = UINT32_MAX;
+
+	rp_timer_init(&q->timer, dns_timer_handler, q);
+	DL_APPEND(dns->queries, q);
+
+	*query = q;
+
+	if (dns_open(q)) {
+		// moves on to the next server, or fails on the next poll so
+		// the handler never runs before this returns.
+		rp_timer_add(rp_event_timers(dns->ev), &q->timer, rp_current_msec);
+	}
+
+	return 0;
+}
+
+void
+rp_dns_cancel(struct rp_dns_ctx *dns, struct rp_dns_query *query)
+{
+	(void)dns;
+
+	dns_release(query);
+}
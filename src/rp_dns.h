@@ -0,0 +1,64 @@
+#ifndef RP_DNS_H
+#define RP_DNS_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <rp_palloc.h>
+
+// a stub resolver that runs on an event context. names are looked up as
+// ip literals, in /etc/hosts, in a cache that honours the ttls of the
+// answers and can be kept on disk, and otherwise asked for A and AAAA at
+// the nameservers of /etc/resolv.conf over udp, or tcp if an answer was
+// truncated.
+
+struct rp_event_ctx;
+struct rp_dns_ctx;
+struct rp_dns_query;
+
+#define RP_DNS_MAX_NAME  253
+#define RP_DNS_MAX_ADDRS 16
+
+// an address a name resolved to, its port is 0.
+struct rp_dns_addr {
+	socklen_t len;
+
+	union {
+		struct sockaddr     sa;
+		struct sockaddr_in  in;
+		struct sockaddr_in6 in6;
+	} u;
+};
+
+// the result of a lookup, ipv6 addresses come first. n_addrs is 0 if the
+// name could not be resolved. the addresses are only valid during the
+// call.
+typedef void (*rp_dns_handler_t)(void *data, const struct rp_dns_addr *addrs,
+	size_t n_addrs);
+
+// create the resolver of an event context and read the system config.
+int rp_dns_init(rp_pool_t *pool, struct rp_event_ctx *ev,
+	struct rp_dns_ctx **dns);
+
+// ask ADDR[#PORT] instead of the nameservers from /etc/resolv.conf, can be
+// called more than once to add more servers.
+int rp_dns_nameserver(struct rp_dns_ctx *dns, const char *spec);
+
+// load the cache from path and write it back there whenever an answer
+// was added.
+int rp_dns_cache_file(struct rp_dns_ctx *dns, const char *path);
+
+// resolve name and call handler with the result. a name that is known
+// already is answered before this returns and query is set to NULL,
+// otherwise query can be used to cancel the lookup until the handler
+// runs.
+int rp_dns_resolve(struct rp_dns_ctx *dns, const char *name,
+	rp_dns_handler_t handler, void *data, struct rp_dns_query **query);
+
+// stop a lookup, its handler is not called.
+void rp_dns_cancel(struct rp_dns_ctx *dns, struct rp_dns_query *query);
+
+// set an address from its text form, returns -1 if it is not an ip.
+int rp_dns_addr_parse(struct rp_dns_addr *addr, const char *str);
+
+#endif // RP_DNS_H
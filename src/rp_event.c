@@ -1,116 +1,248 @@
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <netdb.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include <signal.h>
+#include <pthread.h>
 #include <rpbot.h>
 #include <rp_event.h>
+#include <utlist.h>
+#include <rp_math.h>
+#include <rp_uring.h>
+#include <rp_dns.h>
+
+// a registered fd, epoll hands it back in data.ptr. a registration that
+// was deleted is only reused once no event of a poll can point to it
+// anymore, so a late event for its fd never reaches whatever got the
+// same fd number in the meantime.
+struct rp_event_io {
+	rp_event_handler_t  handler; // NULL once the fd was deleted
+	void               *udata;
+	unsigned            mask; // RP_EVENT_READ | RP_EVENT_WRITE
+	int                 fd;
+	struct rp_event_io *next; // on the dead and free lists
+};
 
-// context information about the event system, used to decide which events
-// to listen for on the socket.
+// context information about the event system, shared by all connections.
 struct rp_event_ctx {
-	// next time the client should try to connect
-	uintptr_t next_conn_msec;
+	rp_pool_t *pool;
+
+	// registered fds, indexed by fd
+	struct rp_event_io **ios;
+	size_t               n_ios;
 
-	// when the client should stop trying to connect
-	uintptr_t conn_timeout_msec;
+	// deleted registrations, and the ones that can be reused
+	struct rp_event_io  *io_dead;
+	struct rp_event_io  *io_free;
 
-	// addrinfo list
-	struct addrinfo *res0;
-	struct addrinfo *res;
+	// the events of the running poll
+	struct rp_events *evs;
 
-	struct gaicb host;
-	struct gaicb *host_p;
+	unsigned flags; // RP_EVENT_*
 
-	char *ar_service;
-	char *ar_name;
+	int sig_fd; // signal event fd, only with RP_EVENT_SIGINT
+	int wake_fd; // eventfd for rp_event_wake
+	int epoll_fd; // epoll fd
 
-	struct addrinfo hints;
-	struct sigevent sig;
+	rp_timer_wheel_t timers;
 
-	// connection state
-	enum {
-		DISCONNECTED = 0,
-		RESOLVING,
-		RESOLVED,
-		CONNECTING,
-		CONNECTED,
-	} state;
+	struct rp_dns_ctx *dns;
 
-	int addr_sig; // address resolution signal
-	int sock_fd; // socket fd
-	int sig_fd; // signal event fd
-	int epoll_fd; // epoll fd
+	// the io_uring backend, NULL when sockets are driven by epoll
+	rp_uring_t *uring;
+	unsigned int uring_poll:1; // the poll on epoll_fd is queued
 
-	unsigned int read_full:1; // whether or not the read buf was full
-	unsigned int write_full:1; // whether or not the write buf was full
+	struct rp_event_stats stats;
 
-	struct rp_config *cfg;
-	rp_fifo_t        *read_buf; // socket read buffer
-	rp_fifo_t        *write_buf; // socket write buffer
+	struct rp_conn *conns; // all connections
+
+	// the connections with something to handle and the end of the list
+	struct rp_conn  *ready;
+	struct rp_conn **ready_tail;
 };
 
 #define IRC_CONNECT_TIMEOUT (5 * 1000)
-#define IRC_RETRY_DELAY (30 * 1000)
+#define IRC_CONNECT_STAGGER 250 // between connects to the addresses, rfc 8305
+
+// reconnect backoff, the delay doubles with every failed connect up to
+// IRC_RETRY_MAX. a connection that stayed up for IRC_STABLE_TIME resets
+// it and is followed by an immediate reconnect.
+#define IRC_RETRY_MIN (250)
+#define IRC_RETRY_MAX (2 * 60 * 1000)
+#define IRC_STABLE_TIME (60 * 1000)
+
+// how long the kernel keeps a connection that stopped acking data, or
+// that went silent while idle, before it reports an error on it.
+#define IRC_USER_TIMEOUT (20 * 1000)
+#define IRC_KEEPIDLE 30 // sec
+#define IRC_KEEPINTVL 5 // sec
+#define IRC_KEEPCNT 3
 #define MAX_EVENTS 64
 
-// reset the addrinfo list
-static void
-rp_freeaddrinfo(struct rp_event_ctx *ctx)
+#define URING_ENTRIES 256
+
+// the low bits of a connection pointer in user_data tell the operation
+// apart, user_data 0 is the poll on the epoll fd.
+#define URING_EPOLL  0
+#define URING_RECV   1
+#define URING_SEND   2
+#define URING_CANCEL 3
+#define URING_OP_MASK 7
+
+static uint32_t
+epoll_mask(unsigned mask)
 {
-	if (ctx->res0) {
-		freeaddrinfo(ctx->res0);
+	uint32_t events = EPOLLRDHUP | EPOLLET;
+
+	if (mask & RP_EVENT_READ) {
+		events |= EPOLLIN;
+	}
+
+	if (mask & RP_EVENT_WRITE) {
+		events |= EPOLLOUT;
 	}
 
-	ctx->res0 = NULL;
-	ctx->res = NULL;
+	return events;
 }
 
-// find the next available RT signal
-static int
-find_rt_signal()
+static struct rp_event_io *
+io_lookup(struct rp_event_ctx *ctx, int fd)
 {
-	struct sigaction act;
-	int sig = SIGRTMIN;
+	if (fd < 0 || (size_t)fd >= ctx->n_ios) {
+		return NULL;
+	}
 
-	while (sig <= SIGRTMAX) {
-		if (sigaction(sig, NULL, &act) != 0) {
-			if (errno == EINTR) {
-				continue;
-			}
-		} else {
-			if (act.sa_flags & SA_SIGINFO) {
-				if (act.sa_sigaction == NULL) {
-					return sig;
-				}
-			} else {
-				if (act.sa_handler == SIG_DFL) {
-					return sig;
-				}
-			}
+	return ctx->ios[fd];
+}
+
+int
+rp_event_add(struct rp_event_ctx *ctx, int fd, unsigned mask,
+	rp_event_handler_t handler, void *udata)
+{
+	struct epoll_event ctl_event;
+	struct rp_event_io *io;
+
+	if (fd < 0 || io_lookup(ctx, fd)) {
+		return -1;
+	}
+
+	if ((size_t)fd >= ctx->n_ios) {
+		size_t n = rp_max(ctx->n_ios * 2, (size_t)fd + 1);
+		struct rp_event_io **ios = realloc(ctx->ios, n * sizeof(*ios));
+
+		if (!ios) {
+			return -1;
 		}
 
-		sig++;
+		memset(ios + ctx->n_ios, 0, (n - ctx->n_ios) * sizeof(*ios));
+		ctx->ios = ios;
+		ctx->n_ios = n;
 	}
 
-	return -1;
+	if ((io = ctx->io_free) != NULL) {
+		ctx->io_free = io->next;
+	} else if ((io = rp_palloc(ctx->pool, sizeof(*io))) == NULL) {
+		return -1;
+	}
+
+	memset(&ctl_event, 0, sizeof(ctl_event));
+	ctl_event.data.ptr = io;
+	ctl_event.events = epoll_mask(mask);
+
+	ctx->stats.syscalls++;
+
+	if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &ctl_event) == -1) {
+		io->next = ctx->io_free;
+		ctx->io_free = io;
+		return -1;
+	}
+
+	io->handler = handler;
+	io->udata = udata;
+	io->mask = mask;
+	io->fd = fd;
+	io->next = NULL;
+	ctx->ios[fd] = io;
+
+	return 0;
+}
+
+int
+rp_event_mod(struct rp_event_ctx *ctx, int fd, unsigned mask)
+{
+	struct epoll_event ctl_event;
+	struct rp_event_io *io = io_lookup(ctx, fd);
+
+	if (!io) {
+		return -1;
+	}
+
+	// the fd is edge triggered, asking for the same events again would
+	// only cost a syscall.
+	if (io->mask == mask) {
+		return 0;
+	}
+
+	memset(&ctl_event, 0, sizeof(ctl_event));
+	ctl_event.data.ptr = io;
+	ctl_event.events = epoll_mask(mask);
+
+	ctx->stats.syscalls++;
+
+	if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, fd, &ctl_event) == -1) {
+		return -1;
+	}
+
+	io->mask = mask;
+
+	return 0;
+}
+
+int
+rp_event_del(struct rp_event_ctx *ctx, int fd)
+{
+	struct rp_event_io *io = io_lookup(ctx, fd);
+
+	if (!io) {
+		return -1;
+	}
+
+	// events of this fd that are still queued in the running poll are
+	// dropped once the handler is gone, the registration is kept from
+	// reuse until the next poll.
+	ctx->ios[fd] = NULL;
+	io->handler = NULL;
+	io->next = ctx->io_dead;
+	ctx->io_dead = io;
+	ctx->stats.syscalls++;
+
+	return epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
 }
 
-// initialize signal handling
+static void handle_sig_event(struct rp_event_ctx *ctx, int fd,
+	unsigned events, void *udata);
+
+// receive SIGINT through a signal fd
 static int
 sig_init(struct rp_event_ctx *ctx)
 {
 	sigset_t mask;
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
-	sigaddset(&mask, ctx->addr_sig); // used for address resolution
 
-	if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
-		perror("sigprocmask()");
+	// the mask is inherited by threads created afterwards
+	if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
+		perror("pthread_sigmask()");
 		abort();
 	}
 
@@ -121,27 +253,31 @@ sig_init(struct rp_event_ctx *ctx)
 		abort();
 	}
 
-	// add the signal fd to epoll
-	struct epoll_event sig_ctl_event;
-	memset(&sig_ctl_event, 0, sizeof(sig_ctl_event));
-	sig_ctl_event.data.fd = ctx->sig_fd;
-	sig_ctl_event.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLET;
+	return rp_event_add(ctx, ctx->sig_fd, RP_EVENT_READ, handle_sig_event,
+	                    NULL);
+}
 
-	epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->sig_fd, &sig_ctl_event);
+static void
+handle_wake_event(struct rp_event_ctx *ctx, int fd, unsigned events,
+	void *udata)
+{
+	uint64_t v;
 
-	return 0;
+	while (read(fd, &v, sizeof(v)) > 0) {
+		// void
+	}
 }
 
-int rp_event_init(rp_pool_t *pool, struct rp_config *cfg,
-	rp_fifo_t *read_buf, rp_fifo_t *write_buf, struct rp_event_ctx **ctx)
+int
+rp_event_init(rp_pool_t *pool, unsigned flags, struct rp_event_ctx **ctx)
 {
 	struct rp_event_ctx *c;
 	c = rp_pcalloc(pool, sizeof(*c));
 
-	c->state = DISCONNECTED;
-	c->sock_fd = -1;
-	c->addr_sig = -1;
+	c->pool = pool;
+	c->flags = flags;
 	c->sig_fd = -1;
+	c->ready_tail = &c->ready;
 	c->epoll_fd = epoll_create1(0);
 
 	if (c->epoll_fd == -1) {
@@ -149,286 +285,929 @@ int rp_event_init(rp_pool_t *pool, struct rp_config *cfg,
 		abort();
 	}
 
-	// TODO: find good values for this
-	c->ar_name = rp_palloc(pool, 256);
-	c->ar_service = rp_palloc(pool, 32);
+	rp_timer_wheel_init(&c->timers, rp_current_msec);
 
-	memset(&c->host, 0, sizeof(c->host));
-	c->host.ar_name = c->ar_name;
-	c->host.ar_service = c->ar_service;
+	c->wake_fd = eventfd(0, EFD_NONBLOCK);
 
-	c->host_p = &c->host;
-	c->host.ar_request = &c->hints;
-
-	c->addr_sig = find_rt_signal();
+	if (c->wake_fd == -1) {
+		perror("eventfd()");
+		abort();
+	}
 
-	if (c->addr_sig == -1) {
-		perror("find_rt_signal()");
+	if (rp_event_add(c, c->wake_fd, RP_EVENT_READ, handle_wake_event, NULL)) {
+		perror("rp_event_add(wake_fd)");
 		abort();
 	}
 
-	if (sig_init(c)) {
+	if ((flags & RP_EVENT_SIGINT) && sig_init(c)) {
 		perror("sig_init()");
 		abort();
 	}
 
+	if (rp_dns_init(pool, c, &c->dns)) {
+		perror("rp_dns_init()");
+		abort();
+	}
+
+	if (flags & RP_EVENT_URING) {
+		c->uring = rp_palloc(pool, sizeof(*c->uring));
+
+		if (!c->uring || rp_uring_init(c->uring, URING_ENTRIES)) {
+			fprintf(stderr, "io_uring is not available, using epoll\n");
+			c->uring = NULL;
+		}
+	}
+
+	*ctx = c;
+
+	return 0;
+}
+
+static int start_resolve(struct rp_event_ctx *ctx, struct rp_conn *conn);
+static int rp_disconnect(struct rp_event_ctx *ctx, struct rp_conn *conn);
+static int rp_tryconnect(struct rp_event_ctx *ctx, struct rp_conn *conn);
+static void handle_sock_event(struct rp_event_ctx *ctx, int fd,
+	unsigned events, void *udata);
+static void uring_cancel(struct rp_event_ctx *ctx, struct rp_conn *conn);
+
+// the retry delay, the connect stagger or a connect timeout ran out.
+static void
+conn_timer_handler(rp_timer_t *timer)
+{
+	struct rp_conn *conn = timer->data;
+
+	switch (conn->state) {
+	case RP_CONN_DISCONNECTED:
+		conn->state = RP_CONN_RESOLVING;
+
+		if (start_resolve(conn->ev, conn)) {
+			fprintf(stderr, "could not resolve %s\n", conn->host);
+			rp_disconnect(conn->ev, conn);
+		}
+
+		break;
+	case RP_CONN_RESOLVED:
+	case RP_CONN_CONNECTING:
+		rp_tryconnect(conn->ev, conn);
+		break;
+	default:
+		break;
+	}
+}
+
+int
+rp_event_add_conn(struct rp_event_ctx *ctx, struct rp_config *cfg,
+	rp_fifo_t *read_buf, rp_chain_t *write_buf, struct rp_conn **conn)
+{
+	struct rp_conn *c;
+	c = rp_pcalloc(ctx->pool, sizeof(*c));
+
+	if (!c) {
+		return -1;
+	}
+
+	c->state = RP_CONN_DISCONNECTED;
+	c->sock_fd = -1;
+
+	c->host = rp_palloc(ctx->pool, RP_DNS_MAX_NAME + 1);
+
+	if (!c->host) {
+		return -1;
+	}
+
+	struct rp_config_server *server;
+
+	LL_COUNT(cfg->servers, server, c->n_servers);
+
+	if (c->n_servers == 0) {
+		return -1;
+	}
+
+	c->servers = rp_palloc(ctx->pool, c->n_servers * sizeof(*c->servers));
+
+	if (!c->servers) {
+		return -1;
+	}
+
+	c->n_servers = 0;
+
+	LL_FOREACH(cfg->servers, server) {
+		c->servers[c->n_servers].cfg = server;
+		c->servers[c->n_servers].fails = 0;
+		c->n_servers++;
+	}
+
 	c->cfg = cfg;
 	c->read_buf = read_buf;
 	c->write_buf = write_buf;
+	c->ev = ctx;
+	c->seed = (unsigned)((uintptr_t)c ^ rp_current_msec);
 
-	*ctx = c;
+	LL_APPEND(ctx->conns, c);
+
+	// start connecting on the next poll
+	rp_timer_init(&c->timer, conn_timer_handler, c);
+	rp_timer_add(&ctx->timers, &c->timer, rp_current_msec);
+
+	*conn = c;
 
 	return 0;
 }
 
-// start an asynchronous address resolution
-static int
-start_resolve(struct rp_event_ctx *ctx)
+struct rp_conn *
+rp_event_conns(struct rp_event_ctx *ctx)
+{
+	return ctx->conns;
+}
+
+struct rp_conn *
+rp_event_ready_conns(struct rp_event_ctx *ctx)
 {
-	memset(&ctx->hints, 0, sizeof(ctx->hints));
+	return ctx->ready;
+}
 
-	ctx->hints.ai_family = AF_UNSPEC; // ipv4 or v6
-	ctx->hints.ai_socktype = SOCK_STREAM;
+void
+rp_event_ready(struct rp_event_ctx *ctx, struct rp_conn *conn)
+{
+	if (conn->ready) {
+		return;
+	}
 
-	struct rp_config_server *server = ctx->cfg->servers;
+	conn->ready = 1;
+	conn->ready_next = NULL;
+	*ctx->ready_tail = conn;
+	ctx->ready_tail = &conn->ready_next;
+}
 
-	memcpy(ctx->ar_name, server->host.ptr, server->host.len);
-	ctx->ar_name[server->host.len] = '\0';
+struct rp_dns_ctx *
+rp_event_dns(struct rp_event_ctx *ctx)
+{
+	return ctx->dns;
+}
 
-	memcpy(ctx->ar_service, server->port.ptr, server->port.len);
-	ctx->ar_service[server->port.len] = '\0';
+rp_timer_wheel_t *
+rp_event_timers(struct rp_event_ctx *ctx)
+{
+	return &ctx->timers;
+}
 
-	ctx->sig.sigev_notify = SIGEV_SIGNAL;
-	ctx->sig.sigev_signo = ctx->addr_sig;
-	ctx->sig.sigev_value.sival_ptr = ctx->host_p;
+int
+rp_event_wake(struct rp_event_ctx *ctx)
+{
+	uint64_t one = 1;
 
-	getaddrinfo_a(GAI_NOWAIT, &ctx->host_p, 1, &ctx->sig);
+	if (write(ctx->wake_fd, &one, sizeof(one)) != sizeof(one)) {
+		return errno == EAGAIN ? 0 : -1;
+	}
 
 	return 0;
 }
 
-// disconnect and clean up the socket.
+void
+rp_event_stats(struct rp_event_ctx *ctx, struct rp_event_stats *stats)
+{
+	*stats = ctx->stats;
+
+	if (ctx->uring) {
+		stats->syscalls += ctx->uring->syscalls;
+	}
+}
+
 static int
-rp_disconnect(struct rp_event_ctx *ctx)
+addr_equal(const struct rp_dns_addr *a, const struct rp_dns_addr *b)
 {
-	epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, ctx->sock_fd, NULL);
-	close(ctx->sock_fd);
+	if (a->u.sa.sa_family != b->u.sa.sa_family) {
+		return 0;
+	}
 
-	ctx->sock_fd = -1;
-	ctx->state = DISCONNECTED;
-	ctx->next_conn_msec = rp_current_msec + IRC_RETRY_DELAY;
-	rp_freeaddrinfo(ctx);
+	if (a->u.sa.sa_family == AF_INET6) {
+		return memcmp(&a->u.in6.sin6_addr, &b->u.in6.sin6_addr,
+		              sizeof(a->u.in6.sin6_addr)) == 0;
+	}
 
-	return 0;
+	return a->u.in.sin_addr.s_addr == b->u.in.sin_addr.s_addr;
+}
+
+static struct rp_conn_addr_stat *
+addr_stat(struct rp_conn *conn, const struct rp_dns_addr *addr)
+{
+	size_t i;
+
+	for (i = 0; i < conn->n_addr_stats; i++) {
+		if (addr_equal(&conn->addr_stats[i].addr, addr)) {
+			return &conn->addr_stats[i];
+		}
+	}
+
+	return NULL;
 }
 
-// attempt a non-blocking connection to the server.
+// remember how connecting to an address went, the oldest address is
+// forgotten when the table is full.
+static void
+addr_stat_set(struct rp_conn *conn, const struct rp_dns_addr *addr,
+	uintptr_t msec, int failed)
+{
+	struct rp_conn_addr_stat *st = addr_stat(conn, addr);
+
+	if (!st) {
+		if (conn->n_addr_stats == RP_DNS_MAX_ADDRS) {
+			memmove(conn->addr_stats, conn->addr_stats + 1,
+			        (RP_DNS_MAX_ADDRS - 1) * sizeof(conn->addr_stats[0]));
+			conn->n_addr_stats--;
+		}
+
+		st = &conn->addr_stats[conn->n_addr_stats++];
+		st->addr = *addr;
+	}
+
+	st->msec = msec;
+	st->failed = failed;
+}
+
+// addresses that connected before come first, fastest first, then the
+// unknown ones and the ones that failed last.
 static int
-rp_tryconnect(struct rp_event_ctx *ctx)
+addr_before(struct rp_conn *conn, const struct rp_dns_addr *a,
+	const struct rp_dns_addr *b)
 {
-	if (ctx->res == NULL) {
-		ctx->res = ctx->res0;
-	} else {
-		ctx->res = ctx->res->ai_next;
+	struct rp_conn_addr_stat *sa = addr_stat(conn, a);
+	struct rp_conn_addr_stat *sb = addr_stat(conn, b);
+	unsigned ra = !sa ? 1 : sa->failed ? 2 : 0;
+	unsigned rb = !sb ? 1 : sb->failed ? 2 : 0;
+
+	if (ra != rb) {
+		return ra < rb;
 	}
 
-	// if the address is null here, then all have been tried
-	if (ctx->res == NULL) {
-		rp_disconnect(ctx);
+	return ra == 0 && sa->msec < sb->msec;
+}
 
-		return 0;
+// order the addresses to race: sorted by what is known about them, with
+// the address families taking turns so a broken family only ever costs
+// one stagger.
+static void
+order_addrs(struct rp_conn *conn, const struct rp_dns_addr *addrs,
+	size_t n_addrs)
+{
+	struct rp_dns_addr sorted[RP_DNS_MAX_ADDRS];
+	size_t i, j, n = 0, next[2] = { 0, 0 };
+	int family;
+
+	// stable, the resolver order breaks ties
+	for (i = 0; i < n_addrs; i++) {
+		for (j = i; j > 0 && addr_before(conn, &addrs[i], &sorted[j - 1]); j--) {
+			sorted[j] = sorted[j - 1];
+		}
+
+		sorted[j] = addrs[i];
 	}
 
-	if ((ctx->sock_fd = socket(ctx->res->ai_family,
-	                           ctx->res->ai_socktype,
-	                           ctx->res->ai_protocol)) == -1) {
-		fprintf(stderr, "failed to create socket\n");
-		goto conn_fail;
+	family = sorted[0].u.sa.sa_family == AF_INET6;
+
+	while (n < n_addrs) {
+		// the next address of the family whose turn it is, if any
+		for (i = next[family]; i < n_addrs; i++) {
+			if ((sorted[i].u.sa.sa_family == AF_INET6) == family) {
+				break;
+			}
+		}
+
+		if (i < n_addrs) {
+			conn->addrs[n++] = sorted[i];
+			next[family] = i + 1;
+		} else {
+			next[family] = n_addrs;
+		}
+
+		family = !family;
 	}
 
-	int flags = 0;
+	conn->n_addrs = n_addrs;
+}
+
+// the addresses of the server are known, start racing them.
+static void
+handle_resolved(void *data, const struct rp_dns_addr *addrs, size_t n_addrs)
+{
+	struct rp_conn *conn = data;
 
-	if (fcntl(ctx->sock_fd, F_GETFL, 0) == -1) {
-		flags = 0;
+	conn->query = NULL;
+
+	if (n_addrs == 0) {
+		fprintf(stderr, "could not resolve %s\n", conn->host);
+		rp_disconnect(conn->ev, conn);
+		return;
 	}
 
-	if (fcntl(ctx->sock_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-		fprintf(stderr, "failed to set O_NONBLOCK\n");
-		goto conn_fail;
+	order_addrs(conn, addrs, n_addrs);
+	conn->next_addr = 0;
+	conn->stagger_at = rp_current_msec;
+
+	conn->state = RP_CONN_RESOLVED;
+	rp_tryconnect(conn->ev, conn);
+}
+
+// look up the server, cached names connect before this returns.
+static int
+start_resolve(struct rp_event_ctx *ctx, struct rp_conn *conn)
+{
+	struct rp_config_server *server = conn->servers[conn->server].cfg;
+	char port[8];
+	unsigned long p;
+
+	if (server->host.len > RP_DNS_MAX_NAME || server->port.len >= sizeof(port)) {
+		return -1;
 	}
 
-	if (connect(ctx->sock_fd, ctx->res->ai_addr, ctx->res->ai_addrlen) == 0) {
-		// if connect succeeded, something went terribly wrong, because
-		// this is a non-blocking socket.
-		goto conn_fail;
+	memcpy(conn->host, server->host.ptr, server->host.len);
+	conn->host[server->host.len] = '\0';
+
+	memcpy(port, server->port.ptr, server->port.len);
+	port[server->port.len] = '\0';
+
+	if ((p = strtoul(port, NULL, 10)) == 0 || p > UINT16_MAX) {
+		return -1;
 	}
 
-	if (errno != EINPROGRESS) {
-		fprintf(stderr, "error on connect() %d\n", errno);
-		goto conn_fail;
+	conn->port = (uint16_t)p;
+
+	return rp_dns_resolve(ctx->dns, conn->host, handle_resolved, conn,
+	                      &conn->query);
+}
+
+// give up on a connect, the attempts behind it move up.
+static void
+attempt_close(struct rp_event_ctx *ctx, struct rp_conn *conn, size_t i,
+	int failed)
+{
+	struct rp_conn_attempt *a = &conn->attempts[i];
+
+	rp_event_del(ctx, a->fd);
+	close(a->fd);
+
+	if (failed) {
+		addr_stat_set(conn, &conn->addrs[a->addr], 0, 1);
 	}
 
-	ctx->state = CONNECTING;
-	ctx->conn_timeout_msec = rp_current_msec + IRC_CONNECT_TIMEOUT;
+	conn->n_attempts--;
+	memmove(a, a + 1, (conn->n_attempts - i) * sizeof(*a));
+}
 
-	// listen for events on the socket
-	struct epoll_event ctl_event;
-	memset(&ctl_event, 0, sizeof(ctl_event));
-	ctl_event.data.fd = ctx->sock_fd;
-	ctl_event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLET;
+// the server to try next, the one that failed the fewest times in a row.
+// ties go to the next one in config order, so failing servers are
+// rotated through. the server of the peer is left to it.
+static size_t
+next_server(struct rp_conn *conn)
+{
+	size_t best = conn->n_servers; // none yet
+	size_t i;
+
+	for (i = 1; i <= conn->n_servers; i++) {
+		size_t s = (conn->server + i) % conn->n_servers;
+
+		if (conn->peer && conn->n_servers > 1 && s == conn->peer->server) {
+			continue;
+		}
 
-	epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->sock_fd, &ctl_event);
+		if (best == conn->n_servers ||
+		    conn->servers[s].fails < conn->servers[best].fails) {
+			best = s;
+		}
+	}
+
+	return best;
+}
+
+void
+rp_event_pair(struct rp_conn *primary, struct rp_conn *standby)
+{
+	primary->peer = standby;
+	standby->peer = primary;
+	standby->server = next_server(standby);
+}
+
+// arm the reconnect, at once after a stable connection and otherwise
+// with an exponential backoff. the delay is drawn from its upper half
+// so connections that went down together don't come back together.
+static void
+schedule_retry(struct rp_event_ctx *ctx, struct rp_conn *conn)
+{
+	struct rp_conn_server *server = &conn->servers[conn->server];
+	uintptr_t delay = 0;
+
+	if (conn->connected_at &&
+	    rp_current_msec - conn->connected_at >= IRC_STABLE_TIME) {
+		conn->failures = 0;
+	} else {
+		conn->failures++;
+	}
+
+	// even a server that worked is left for the others for now, it
+	// probably went down.
+	server->fails++;
+	conn->connected_at = 0;
+	conn->server = next_server(conn);
+
+	if (conn->failures > 1) {
+		unsigned shift = rp_min(conn->failures - 2, 16u);
+		uintptr_t base = rp_min((uintptr_t)IRC_RETRY_MIN << shift,
+		                        (uintptr_t)IRC_RETRY_MAX);
+
+		delay = base / 2 + (uintptr_t)rand_r(&conn->seed) % (base / 2 + 1);
+	}
+
+	fprintf(stderr, "reconnecting to %.*s in %lu ms\n",
+	        (int)conn->servers[conn->server].cfg->host.len,
+	        conn->servers[conn->server].cfg->host.ptr, (unsigned long)delay);
+
+	rp_timer_add(&ctx->timers, &conn->timer, rp_current_msec + delay);
+}
+
+// disconnect and clean up the socket, then schedule the reconnect.
+static int
+rp_disconnect(struct rp_event_ctx *ctx, struct rp_conn *conn)
+{
+	// a blocking read holds a reference to the socket, closing the fd
+	// would not end it. the shutdown completes whatever the cancel
+	// could not be queued for.
+	if (conn->uring) {
+		uring_cancel(ctx, conn);
+		shutdown(conn->sock_fd, SHUT_RDWR);
+	}
+
+	if (conn->sock_fd != -1) {
+		rp_event_del(ctx, conn->sock_fd);
+		close(conn->sock_fd);
+	}
+
+	while (conn->n_attempts > 0) {
+		attempt_close(ctx, conn, 0, 0);
+	}
+
+	if (conn->query) {
+		rp_dns_cancel(ctx->dns, conn->query);
+		conn->query = NULL;
+	}
+
+	conn->sock_fd = -1;
+	conn->uring = 0;
+	conn->read_full = 0;
+	conn->write_full = 0;
+	conn->n_addrs = 0;
+	conn->state = RP_CONN_DISCONNECTED;
+	schedule_retry(ctx, conn);
 
 	return 0;
+}
+
+void
+rp_event_destroy(struct rp_event_ctx *ctx)
+{
+	struct rp_conn *conn;
 
-conn_fail:
-	if (ctx->sock_fd != -1) {
-		close(ctx->sock_fd);
+	// the ring goes first, closing it cancels whatever is still queued
+	// on the sockets.
+	if (ctx->uring) {
+		rp_uring_exit(ctx->uring);
+		ctx->uring = NULL;
 	}
 
-	ctx->next_conn_msec = rp_current_msec + IRC_RETRY_DELAY;
-	return -1;
+	LL_FOREACH(ctx->conns, conn) {
+		rp_timer_del(&ctx->timers, &conn->timer);
+
+		while (conn->n_attempts > 0) {
+			attempt_close(ctx, conn, 0, 0);
+		}
+
+		if (conn->query) {
+			rp_dns_cancel(ctx->dns, conn->query);
+			conn->query = NULL;
+		}
+
+		if (conn->sock_fd != -1) {
+			rp_event_del(ctx, conn->sock_fd);
+			close(conn->sock_fd);
+			conn->sock_fd = -1;
+		}
+	}
+
+	if (ctx->sig_fd != -1) {
+		rp_event_del(ctx, ctx->sig_fd);
+		close(ctx->sig_fd);
+		ctx->sig_fd = -1;
+	}
+
+	rp_event_del(ctx, ctx->wake_fd);
+	close(ctx->wake_fd);
+	close(ctx->epoll_fd);
+
+	free(ctx->ios);
+	ctx->ios = NULL;
+	ctx->n_ios = 0;
 }
 
-// read bytes from the socket into the read buffer.
-// NOTE: there MUST be data available in the fifo read buffer before
-//       this is called.
+// an established connection ended.
 static void
-do_read(struct rp_event_ctx *ctx)
+conn_lost(struct rp_event_ctx *ctx, struct rp_conn *conn)
 {
-	while (1) {
-		size_t max_read;
-		ssize_t n_read;
-		void *p;
+	rp_disconnect(ctx, conn);
+	conn->evs.disconnected = 1;
+	rp_event_ready(ctx, conn);
+}
 
-		max_read = rp_fifo_raw_w(ctx->read_buf, &p);
-		n_read = read(ctx->sock_fd, p, max_read);
+void
+rp_event_drop(struct rp_event_ctx *ctx, struct rp_conn *conn)
+{
+	if (conn->state == RP_CONN_CONNECTED) {
+		conn_lost(ctx, conn);
+	}
+}
 
-		if (n_read < 0) {
-			if (errno != EAGAIN) {
-				perror("read()");
-				abort();
-			}
+// start a non-blocking connect to the next address that takes one,
+// returns -1 if no address is left.
+static int
+attempt_start(struct rp_event_ctx *ctx, struct rp_conn *conn)
+{
+	while (conn->next_addr < conn->n_addrs) {
+		size_t i = conn->next_addr++;
+		struct rp_dns_addr *addr = &conn->addrs[i];
+		int fd;
 
-			break;
-		} else if (n_read == 0) {
-			perror("read()");
-			abort();
+		if (addr->u.sa.sa_family == AF_INET6) {
+			addr->u.in6.sin6_port = htons(conn->port);
+		} else {
+			addr->u.in.sin_port = htons(conn->port);
+		}
+
+		if ((fd = socket(addr->u.sa.sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1) {
+			perror("socket()");
+			continue;
+		}
+
+		// writes are already coalesced per poll, nagle would only hold
+		// back the reply to a ping until the previous segment is acked.
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		// don't wait the 15 minutes of retransmits it takes by default
+		// to notice a dead peer.
+		unsigned user_timeout = IRC_USER_TIMEOUT;
+		int idle = IRC_KEEPIDLE, intvl = IRC_KEEPINTVL, cnt = IRC_KEEPCNT;
+
+		setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout,
+		           sizeof(user_timeout));
+		setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
+		setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt));
+
+		// a connect that completed right away, as it can on loopback,
+		// is registered like a pending one. the socket is writable
+		// already, so the first poll reports it and it wins the race
+		// the same way.
+		if (connect(fd, &addr->u.sa, addr->len) == -1 && errno != EINPROGRESS) {
+			addr_stat_set(conn, addr, 0, 1);
+			close(fd);
+			continue;
+		}
+
+		// listen for events on the socket, writable means connected
+		if (rp_event_add(ctx, fd, RP_EVENT_READ | RP_EVENT_WRITE,
+		                 handle_sock_event, conn)) {
+			perror("rp_event_add()");
+			close(fd);
+			continue;
+		}
+
+		conn->attempts[conn->n_attempts].fd = fd;
+		conn->attempts[conn->n_attempts].addr = i;
+		conn->attempts[conn->n_attempts].started = rp_current_msec;
+		conn->n_attempts++;
+
+		return 0;
+	}
+
+	return -1;
+}
+
+// race connects to the addresses of the server, rfc 8305 style. a new
+// one starts every IRC_CONNECT_STAGGER ms or as soon as one fails, until
+// the first connects or all of them ran out of time.
+static int
+rp_tryconnect(struct rp_event_ctx *ctx, struct rp_conn *conn)
+{
+	size_t i = 0;
+
+	while (i < conn->n_attempts) {
+		if (rp_current_msec - conn->attempts[i].started >= IRC_CONNECT_TIMEOUT) {
+			attempt_close(ctx, conn, i, 1);
+		} else {
+			i++;
 		}
+	}
 
-		rp_fifo_reserve(ctx->read_buf, n_read);
+	if (rp_current_msec >= conn->stagger_at && attempt_start(ctx, conn) == 0) {
+		conn->stagger_at = rp_current_msec + IRC_CONNECT_STAGGER;
+	}
+
+	// all addresses have been tried
+	if (conn->n_attempts == 0) {
+		fprintf(stderr, "could not connect to %s\n", conn->host);
+		rp_disconnect(ctx, conn);
+
+		return -1;
+	}
+
+	conn->state = RP_CONN_CONNECTING;
+
+	// wake up for the next address or when the oldest connect gives up
+	uintptr_t next = conn->attempts[0].started + IRC_CONNECT_TIMEOUT;
+
+	if (conn->next_addr < conn->n_addrs) {
+		next = rp_min(next, conn->stagger_at);
+	}
 
-		if (rp_fifo_bytes_free(ctx->read_buf) == 0) {
-			ctx->read_full = 1;
+	rp_timer_add(&ctx->timers, &conn->timer, next);
+
+	return 0;
+}
+
+// an event on one of the racing sockets of a connection. the first one
+// that connects wins and the others are closed. returns -1 unless the
+// connection is established.
+static int
+attempt_event(struct rp_event_ctx *ctx, struct rp_conn *conn, int fd,
+	unsigned events)
+{
+	size_t i;
+
+	for (i = 0; i < conn->n_attempts; i++) {
+		if (conn->attempts[i].fd == fd) {
 			break;
 		}
 	}
+
+	if (i == conn->n_attempts) {
+		return -1;
+	}
+
+	if (events & RP_EVENT_ERROR) {
+		// no need to wait for the stagger to try the next one
+		attempt_close(ctx, conn, i, 1);
+		conn->stagger_at = rp_current_msec;
+		rp_tryconnect(ctx, conn);
+
+		return -1;
+	}
+
+	if (!(events & RP_EVENT_WRITE)) {
+		return -1;
+	}
+
+	struct rp_conn_attempt *a = &conn->attempts[i];
+
+	addr_stat_set(conn, &conn->addrs[a->addr],
+	              rp_current_msec - a->started, 0);
+
+	conn->sock_fd = fd;
+	conn->n_attempts--;
+	memmove(a, a + 1, (conn->n_attempts - i) * sizeof(*a));
+
+	while (conn->n_attempts > 0) {
+		attempt_close(ctx, conn, 0, 0);
+	}
+
+	rp_timer_del(&ctx->timers, &conn->timer);
+
+	return 0;
+}
+
+// read bytes from the socket into the read buffer, returns the number of
+// bytes read or -1 once the server closed the connection or it broke.
+// a single readv fills all the free space, even where it wraps. a read
+// that comes back short drained the socket, edge triggered epoll
+// reports the next data that arrives, so there is no need to ask again
+// just to get EAGAIN.
+// NOTE: there MUST be space available in the fifo read buffer before
+//       this is called.
+static ssize_t
+do_read(struct rp_conn *conn)
+{
+	struct iovec iov[2];
+	ssize_t n_read;
+	int n_iov;
+
+	n_iov = rp_fifo_iov_w(conn->read_buf, iov);
+
+	do {
+		n_read = readv(conn->sock_fd, iov, n_iov);
+		conn->ev->stats.syscalls++;
+		conn->ev->stats.reads++;
+	} while (n_read < 0 && errno == EINTR);
+
+	if (n_read < 0) {
+		if (errno != EAGAIN) {
+			perror("readv()");
+			return -1;
+		}
+
+		return 0;
+	} else if (n_read == 0) {
+		return -1;
+	}
+
+	rp_fifo_reserve(conn->read_buf, n_read);
+	conn->ev->stats.bytes_in += n_read;
+
+	if (rp_fifo_bytes_free(conn->read_buf) == 0) {
+		conn->read_full = 1;
+	}
+
+	return n_read;
 }
 
-// write data to the socket from the read buffer.
-// NOTE: there MUST be data in the fifo buffer before this is called.
-static void
-do_write(struct rp_event_ctx *ctx)
+// write data to the socket from the write buffer, returns -1 if the
+// connection broke. the chunks of the buffer go out in a single
+// sendmsg, the gather version of writev that takes MSG_NOSIGNAL.
+// NOTE: there MUST be data in the write buffer before this is called.
+static int
+do_write(struct rp_conn *conn)
 {
 	while (1) {
-		size_t max_write;
+		struct iovec iov[RP_EVENT_IOV];
+		struct msghdr msg;
+		size_t max_write = 0;
 		ssize_t n_written;
-		void *p;
+		int i;
 
-		max_write = rp_fifo_raw_r(ctx->write_buf, &p);
-		n_written = write(ctx->sock_fd, p, max_write);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = (size_t)rp_chain_iov(conn->write_buf, iov, RP_EVENT_IOV);
+
+		for (i = 0; i < (int)msg.msg_iovlen; i++) {
+			max_write += iov[i].iov_len;
+		}
+
+		n_written = sendmsg(conn->sock_fd, &msg, MSG_NOSIGNAL);
+		conn->ev->stats.syscalls++;
+		conn->ev->stats.writes++;
 
 		if (n_written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
 			if (errno != EAGAIN) {
-				perror("write()");
-				abort();
+				perror("sendmsg()");
+				return -1;
 			}
 
-			ctx->write_full = 1;
+			conn->write_full = 1;
 
 			break;
-		} else if (n_written == 0) {
-			perror("write()");
-			abort();
 		}
 
-		rp_fifo_consume(ctx->write_buf, n_written);
+		rp_chain_consume(conn->write_buf, n_written);
+		conn->ev->stats.bytes_out += n_written;
 
-		if (rp_fifo_count(ctx->write_buf) == 0) {
+		// a short write means the socket buffer is full, asking
+		// again would only return EAGAIN.
+		if ((size_t)n_written < max_write) {
+			conn->write_full = 1;
+			break;
+		}
+
+		if (rp_chain_count(conn->write_buf) == 0) {
 			break;
 		}
 	}
+
+	return 0;
 }
 
-// handle a single epoll event.
-static int
-handle_sock_event(struct rp_event_ctx *ctx, struct rp_events *evs,
-	struct epoll_event *e)
+// the connect went through and nothing of the previous socket uses the
+// buffers anymore, the connection is handed to its owner.
+static void
+conn_established(struct rp_event_ctx *ctx, struct rp_conn *conn)
 {
-	if ((e->events & EPOLLRDHUP) ||
-	    (e->events & EPOLLERR) ||
-	    (e->events & EPOLLHUP)) {
-		rp_disconnect(ctx);
-		evs->disconnected = 1;
-
-		return 0;
+	int fd = conn->sock_fd;
+
+	conn->state = RP_CONN_CONNECTED;
+	conn->connected_at = rp_current_msec;
+	conn->servers[conn->server].fails = 0;
+	conn->evs.connected = 1;
+	rp_event_ready(ctx, conn);
+
+	// whatever was left of the previous connection is stale, the
+	// registration has to go out first.
+	rp_fifo_reset(conn->read_buf);
+	rp_chain_reset(conn->write_buf);
+	conn->discard = 0;
+
+	if (!ctx->uring) {
+		rp_event_mod(ctx, fd, RP_EVENT_READ);
+		return;
 	}
 
-	if ((e->events & EPOLLIN) && (rp_fifo_bytes_free(ctx->read_buf) > 0)) {
-		do_read(ctx);
+	// from here on the ring drives the socket until it is closed, each
+	// connect starts over with a new non-blocking socket. the ring only
+	// waits for data on blocking sockets, on non-blocking ones it
+	// completes with EAGAIN. the epoll calls of do_read and do_write
+	// never see the socket, it is not registered with epoll anymore.
+	rp_event_del(ctx, fd);
+	conn->uring = 1;
+
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	if (flags != -1) {
+		fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
 	}
+}
 
-	if (e->events & EPOLLOUT) {
-		if (ctx->state == CONNECTING) {
-			// if connecting, then EPOLLOUT means the connection has
-			// succeeded.
-			struct epoll_event ctl_event;
-			memset(&ctl_event, 0, sizeof(ctl_event));
-			ctl_event.data.fd = ctx->sock_fd;
-			ctl_event.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLET;
+// handle a single event on a connection's socket.
+static void
+handle_sock_event(struct rp_event_ctx *ctx, int fd, unsigned events,
+	void *udata)
+{
+	struct rp_conn *conn = udata;
+
+	if (conn->state == RP_CONN_CONNECTING) {
+		if (attempt_event(ctx, conn, fd, events)) {
+			return;
+		}
 
-			epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, ctx->sock_fd, &ctl_event);
+		// the cancelled reads and sends of the previous socket may
+		// still write into the buffers or send from them, they are
+		// reset once the last one completed.
+		if (conn->uring_ops > 0) {
+			conn->state = RP_CONN_DRAINING;
+			return;
+		}
+
+		conn_established(ctx, conn);
 
-			ctx->state = CONNECTED;
-			evs->connected = 1;
-		} else if (rp_fifo_count(ctx->write_buf) > 0) {
-			do_write(ctx);
+		// writable only meant connected
+		events &= ~RP_EVENT_WRITE;
+
+		if (conn->uring) {
+			return;
 		}
 	}
 
-	return 0;
+	if (conn->state == RP_CONN_DRAINING) {
+		if (events & RP_EVENT_ERROR) {
+			rp_disconnect(ctx, conn);
+		}
+
+		return;
+	}
+
+	rp_event_ready(ctx, conn);
+
+	// the last lines often arrive along with the hangup, they are read
+	// before the connection is dropped.
+	if ((events & (RP_EVENT_READ | RP_EVENT_ERROR)) &&
+	    rp_fifo_bytes_free(conn->read_buf) > 0 && do_read(conn) < 0) {
+		conn_lost(ctx, conn);
+		return;
+	}
+
+	if (events & RP_EVENT_ERROR) {
+		conn_lost(ctx, conn);
+		return;
+	}
+
+	if ((events & RP_EVENT_WRITE) && rp_chain_count(conn->write_buf) > 0) {
+		conn->write_full = 0;
+
+		if (do_write(conn)) {
+			conn_lost(ctx, conn);
+		}
+	}
 }
 
-static int
-handle_sig_event(struct rp_event_ctx *ctx, struct rp_events *evs,
-	struct epoll_event *e)
+static void
+handle_sig_event(struct rp_event_ctx *ctx, int fd, unsigned events,
+	void *udata)
 {
-	if ((e->events & EPOLLRDHUP) ||
-	    (e->events & EPOLLERR) ||
-	    (e->events & EPOLLHUP)) {
+	if (events & RP_EVENT_ERROR) {
 		fprintf(stderr, "error handling signal\n");
 		abort();
 	}
 
-	if (e->events & EPOLLIN) {
+	if (events & RP_EVENT_READ) {
 		struct signalfd_siginfo fdsi;
 		ssize_t s;
 
-		while ((s = read(ctx->sig_fd, &fdsi, sizeof(fdsi))) > 0) {
+		while ((s = read(fd, &fdsi, sizeof(fdsi))) > 0) {
 			if (s != sizeof(fdsi)) {
 				perror("read(signalfd_signfo)");
 				abort();
 			}
 
 			if (fdsi.ssi_signo == SIGINT) {
-				evs->sig_int = 1;
-			} else if (fdsi.ssi_signo == (uint32_t)ctx->addr_sig) {
-				struct gaicb *host = (struct gaicb *)fdsi.ssi_ptr;
-				// address was resolved
-				ctx->res0 = host->ar_result;
-				ctx->res = NULL;
-
-				ctx->state = RESOLVED;
+				ctx->evs->sig_int = 1;
 			}
 		}
 
@@ -442,69 +1221,207 @@ handle_sig_event(struct rp_event_ctx *ctx, struct rp_events *evs,
 			abort();
 		}
 	}
-
-	return 0;
 }
 
+// read what was left in the socket when the read buffer filled up and
+// write out the write buffer, asking for writability only while
+// something is left over. returns 1 if new input was read, input that
+// waited for room in the write buffer can go on or the connection was
+// lost.
 static int
-rp_tryflush(struct rp_event_ctx *ctx)
+rp_tryflush(struct rp_event_ctx *ctx, struct rp_conn *conn)
 {
-	char update_epoll = 0;
+	unsigned mask = RP_EVENT_READ;
+	int      full = rp_chain_full(conn->write_buf);
+	int      ret = 0;
+	ssize_t  n;
+
+	// a full buffer stopped reading, the socket will not signal the
+	// data that is still waiting again.
+	if (conn->read_full && rp_fifo_bytes_free(conn->read_buf) > 0) {
+		conn->read_full = 0;
+
+		if ((n = do_read(conn)) < 0) {
+			conn_lost(ctx, conn);
+			return 1;
+		}
 
-	struct epoll_event ctl_event;
-	memset(&ctl_event, 0, sizeof(ctl_event));
+		ret = n > 0;
+	}
 
-	ctl_event.data.fd = ctx->sock_fd;
-	ctl_event.events = EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLET;
+	if (rp_chain_count(conn->write_buf) > 0) {
+		if (!conn->write_full && do_write(conn)) {
+			conn_lost(ctx, conn);
+			return 1;
+		}
 
-	if (rp_fifo_bytes_free(ctx->read_buf) > 0) {
-		if (ctx->read_full) {
-			update_epoll = 1;
-		} else {
-			do_read(ctx);
+		if (rp_chain_count(conn->write_buf) > 0) {
+			mask |= RP_EVENT_WRITE;
 		}
-	}
 
-	if (rp_fifo_count(ctx->write_buf) > 0) {
-		if (ctx->write_full) {
-			if (!(ctl_event.events & EPOLLOUT)) {
-				update_epoll = 1;
-				ctl_event.events |= EPOLLOUT;
-			}
-		} else {
-			do_write(ctx);
+		if (full && !rp_chain_full(conn->write_buf)) {
+			ret = 1;
 		}
-	} else {
-		// write buffer is empty, but in a previous loop already
-		// set EPOLLOUT, dont do it.
-		if (ctl_event.events & EPOLLOUT) {
-			update_epoll = 1;
-			ctl_event.events &= ~EPOLLOUT;
+	}
+
+	rp_event_mod(ctx, conn->sock_fd, mask);
+
+	return ret;
+}
+
+// queue a read into the free space of the read buffer and a send for
+// the contents of the write buffer. both scatter or gather over all of
+// their buffer, the iovecs are kept in the connection until the
+// operations complete.
+static void
+uring_flush(struct rp_event_ctx *ctx, struct rp_conn *conn)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!conn->recv_busy && rp_fifo_bytes_free(conn->read_buf) > 0) {
+		if ((sqe = rp_uring_get_sqe(ctx->uring)) != NULL) {
+			sqe->opcode = IORING_OP_READV;
+			sqe->fd = conn->sock_fd;
+			sqe->addr = (uintptr_t)conn->recv_iov;
+			sqe->len = (unsigned)rp_fifo_iov_w(conn->read_buf, conn->recv_iov);
+			sqe->user_data = (uintptr_t)conn | URING_RECV;
+
+			conn->recv_busy = 1;
+			conn->uring_ops++;
 		}
 	}
 
-	int ret = 0;
+	if (conn->sends == 0 && rp_chain_count(conn->write_buf) > 0) {
+		if ((sqe = rp_uring_get_sqe(ctx->uring)) == NULL) {
+			return;
+		}
 
-	if (update_epoll) {
-		ret = epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, ctx->sock_fd,
-		                &ctl_event);
+		memset(&conn->send_msg, 0, sizeof(conn->send_msg));
+		conn->send_msg.msg_iov = conn->send_iov;
+		conn->send_msg.msg_iovlen = (size_t)rp_chain_iov(conn->write_buf,
+		                                                 conn->send_iov,
+		                                                 RP_EVENT_IOV);
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = conn->sock_fd;
+		sqe->addr = (uintptr_t)&conn->send_msg;
+		sqe->len = 1;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = (uintptr_t)conn | URING_SEND;
+
+		conn->sends++;
+		conn->uring_ops++;
 	}
+}
 
-	return ret;
+// cancel everything queued for a connection that is going away. there
+// is at most one receive and one send in flight, so each is cancelled
+// by its own user_data, IORING_ASYNC_CANCEL_ALL would need 5.19.
+static void
+uring_cancel(struct rp_event_ctx *ctx, struct rp_conn *conn)
+{
+	struct io_uring_sqe *sqe;
+	unsigned op;
+
+	for (op = URING_RECV; op <= URING_SEND; op++) {
+		if ((op == URING_RECV && !conn->recv_busy) ||
+		    (op == URING_SEND && conn->sends == 0)) {
+			continue;
+		}
+
+		if ((sqe = rp_uring_get_sqe(ctx->uring)) == NULL) {
+			return;
+		}
+
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (uintptr_t)conn | op;
+		sqe->user_data = (uintptr_t)conn | URING_CANCEL;
+
+		conn->uring_ops++;
+	}
 }
 
-int
-rp_event_poll(struct rp_event_ctx *ctx, struct rp_events *evs, int timeout)
+static void
+uring_complete(struct rp_event_ctx *ctx, struct rp_conn *conn, unsigned op,
+	int res)
 {
-	if (ctx->state == CONNECTED) {
-		rp_tryflush(ctx);
+	conn->uring_ops--;
+
+	switch (op) {
+	case URING_RECV:
+		conn->recv_busy = 0;
+
+		// completions of a socket that is gone are dropped
+		if (!conn->uring) {
+			return;
+		}
+
+		if (res > 0) {
+			rp_fifo_reserve(conn->read_buf, res);
+			ctx->stats.reads++;
+			ctx->stats.bytes_in += res;
+			rp_event_ready(ctx, conn);
+			return;
+		}
+
+		// requeued on the next poll
+		if (res == -EAGAIN || res == -EINTR) {
+			return;
+		}
+
+		break;
+	case URING_SEND:
+		conn->sends--;
+
+		if (!conn->uring) {
+			return;
+		}
+
+		// the space may let held back input go on, the rest of the
+		// buffer goes out with the next flush.
+		if (res > 0) {
+			rp_chain_consume(conn->write_buf, res);
+			ctx->stats.writes++;
+			ctx->stats.bytes_out += res;
+			rp_event_ready(ctx, conn);
+			return;
+		}
+
+		// the rest goes out on the next poll
+		if (res == -EAGAIN || res == -EINTR) {
+			return;
+		}
+
+		break;
+	default:
+		return;
 	}
 
-	int ret = 0;
+	// end of stream or a socket error
+	conn_lost(ctx, conn);
+}
+
+// wait for epoll events and run their handlers, returns the number of
+// events or -1 on error.
+static int
+epoll_dispatch(struct rp_event_ctx *ctx, int timeout)
+{
 	struct epoll_event events[MAX_EVENTS];
+	struct rp_event_io *io;
+	int i;
+
+	// no event of an earlier poll is left that could point to these
+	while ((io = ctx->io_dead) != NULL) {
+		ctx->io_dead = io->next;
+		io->next = ctx->io_free;
+		ctx->io_free = io;
+	}
 
 	int n = epoll_wait(ctx->epoll_fd, events, MAX_EVENTS, timeout);
 
+	ctx->stats.syscalls++;
+	rp_updatetime();
+
 	if (n < 0) {
 		switch (errno) {
 		case EINTR: // this can happen when gdb is attached
@@ -515,45 +1432,146 @@ rp_event_poll(struct rp_event_ctx *ctx, struct rp_events *evs, int timeout)
 		}
 	}
 
-	if (n) {
-		int i;
+	for (i = 0; i < n; i++) {
+		uint32_t e = events[i].events;
+		unsigned mask = 0;
 
-		for (i = 0; i < n; i++) {
-			if (events[i].data.fd == ctx->sock_fd) {
-				handle_sock_event(ctx, evs, &events[i]);
-			} else if (events[i].data.fd == ctx->sig_fd) {
-				handle_sig_event(ctx, evs, &events[i]);
-			}
+		io = events[i].data.ptr;
+
+		// deleted by a handler that ran before, its fd may even have
+		// been reused already.
+		if (!io->handler) {
+			continue;
+		}
+
+		if (e & EPOLLIN) {
+			mask |= RP_EVENT_READ;
+		}
+
+		if (e & EPOLLOUT) {
+			mask |= RP_EVENT_WRITE;
+		}
+
+		if (e & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+			mask |= RP_EVENT_ERROR;
 		}
 
-		ret = 1;
+		io->handler(ctx, io->fd, mask, io->udata);
 	}
-	// else: epoll timed out
 
-	switch (ctx->state) {
-	case DISCONNECTED:
-		if (rp_current_msec >= ctx->next_conn_msec) {
-			if (start_resolve(ctx)) {
-				fprintf(stderr, "could not resolve\n");
-				abort();
+	return n;
+}
+
+// submit the queued socket i/o and wait for completions, the epoll fd
+// is polled through the ring so other fds keep working. returns the
+// number of completions or -1 on error.
+static int
+uring_dispatch(struct rp_event_ctx *ctx, int timeout)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int n = 0;
+
+	if (!ctx->uring_poll && (sqe = rp_uring_get_sqe(ctx->uring)) != NULL) {
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = ctx->epoll_fd;
+		sqe->poll32_events = POLLIN;
+		sqe->user_data = URING_EPOLL;
+
+		ctx->uring_poll = 1;
+	}
+
+	int ret = rp_uring_enter(ctx->uring, 1, timeout);
+
+	rp_updatetime();
+
+	if (ret < 0) {
+		perror("io_uring_enter");
+		return -1;
+	}
+
+	while ((cqe = rp_uring_peek_cqe(ctx->uring)) != NULL) {
+		uintptr_t data = (uintptr_t)cqe->user_data;
+		int res = cqe->res;
+
+		rp_uring_cqe_seen(ctx->uring);
+		n++;
+
+		if (data == URING_EPOLL) {
+			ctx->uring_poll = 0;
+
+			if (epoll_dispatch(ctx, 0) < 0) {
+				return -1;
 			}
 
-			ctx->state = RESOLVING;
+			continue;
 		}
 
-		break;
-	case CONNECTING:
-		if (rp_current_msec >= ctx->conn_timeout_msec) {
-			rp_tryconnect(ctx);
+		struct rp_conn *conn = (struct rp_conn *)(data & ~(uintptr_t)URING_OP_MASK);
+
+		uring_complete(ctx, conn, data & URING_OP_MASK, res);
+
+		// the previous socket is done with the buffers
+		if (conn->state == RP_CONN_DRAINING && conn->uring_ops == 0) {
+			conn_established(ctx, conn);
 		}
-		break;
-	case RESOLVED:
-		rp_tryconnect(ctx);
-		break;
-	default:
-		break;
 	}
 
-	return ret;
+	return n;
 }
 
+int
+rp_event_poll(struct rp_event_ctx *ctx, struct rp_events *evs, int timeout)
+{
+	struct rp_conn *conn, *next_conn;
+
+	// only the connections that were handled since the last poll can
+	// have output or room for input, the list starts over.
+	conn = ctx->ready;
+	ctx->ready = NULL;
+	ctx->ready_tail = &ctx->ready;
+
+	for (; conn; conn = next_conn) {
+		next_conn = conn->ready_next;
+		conn->ready = 0;
+		memset(&conn->evs, 0, sizeof(conn->evs));
+
+		if (conn->state != RP_CONN_CONNECTED) {
+			continue;
+		}
+
+		if (conn->uring) {
+			uring_flush(ctx, conn);
+		} else if (rp_tryflush(ctx, conn)) {
+			// the input is waiting to be handled, don't block
+			rp_event_ready(ctx, conn);
+			timeout = 0;
+		}
+	}
+
+	// sleep until the nearest timer at the latest
+	uintptr_t next = rp_timer_next(&ctx->timers);
+
+	if (next != RP_TIMER_INFINITE) {
+		uintptr_t wait = next > rp_current_msec ? next - rp_current_msec : 0;
+
+		if (timeout < 0 || wait < (uintptr_t)timeout) {
+			timeout = (int)rp_min(wait, (uintptr_t)INT_MAX);
+		}
+	}
+
+	ctx->evs = evs;
+
+	int n = ctx->uring ? uring_dispatch(ctx, timeout)
+	                   : epoll_dispatch(ctx, timeout);
+
+	ctx->evs = NULL;
+
+	if (n < 0) {
+		return -1;
+	}
+
+	rp_timer_expire(&ctx->timers, rp_current_msec);
+
+	return n > 0;
+}
@@ -2,11 +2,13 @@
 #define RP_EVENT_H
 
 #include <stdint.h>
-#include <sys/signalfd.h>
-#include <netdb.h>
 #include <rp_palloc.h>
+#include <sys/uio.h>
 #include <rp_fifo.h>
+#include <rp_chain.h>
 #include <rp_config.h>
+#include <rp_timer.h>
+#include <rp_dns.h>
 
 // events that have occurred during rp_poll.
 struct rp_events {
@@ -16,15 +18,207 @@ struct rp_events {
 	unsigned int sig_int:1;
 };
 
+struct rp_irc_ctx;
+
+// a server of the config and how well it has been doing.
+struct rp_conn_server {
+	struct rp_config_server *cfg;
+	unsigned                 fails; // failures since it last worked
+};
+
+// a connect that is racing the others of its connection.
+struct rp_conn_attempt {
+	int       fd;
+	size_t    addr; // index into the addresses of the connection
+	uintptr_t started; // msec
+};
+
+// what connecting to an address took the last time.
+struct rp_conn_addr_stat {
+	struct rp_dns_addr addr;
+	uintptr_t          msec;
+	unsigned int       failed:1;
+};
+
+// chunks of the write buffer that go out in one send
+#define RP_EVENT_IOV 16
+
+// a single connection to an irc network, all connections of an event
+// context share its epoll instance.
+struct rp_conn {
+	struct rp_config  *cfg;
+	rp_fifo_t         *read_buf; // socket read buffer
+	rp_chain_t        *write_buf; // socket write buffer
+	struct rp_irc_ctx *irc;
+	void              *data; // for the owner of the connection
+
+	// events on this connection during the last rp_event_poll
+	struct rp_events   evs;
+
+	struct rp_event_ctx *ev;
+
+	// connect timeout while connecting, retry delay while disconnected
+	rp_timer_t timer;
+
+	// the servers of the config in the order they are rotated through,
+	// and the one in use
+	struct rp_conn_server *servers;
+	size_t                 n_servers;
+	size_t                 server;
+
+	// the other connection of a network with a standby, the two keep
+	// to different servers where the config has more than one
+	struct rp_conn *peer;
+
+	// reconnect backoff
+	unsigned  failures; // failed connects since the last stable one
+	uintptr_t connected_at; // msec, 0 while not connected
+	unsigned  seed; // for the jitter
+
+	// the server being connected to
+	char    *host;
+	uint16_t port;
+
+	// the addresses of the server in the order they are tried and the
+	// next one to try
+	struct rp_dns_addr   addrs[RP_DNS_MAX_ADDRS];
+	size_t               n_addrs;
+	size_t               next_addr;
+	struct rp_dns_query *query; // while resolving
+
+	// connects in flight, oldest first, and when the next one may start
+	struct rp_conn_attempt attempts[RP_DNS_MAX_ADDRS];
+	size_t                 n_attempts;
+	uintptr_t              stagger_at;
+
+	// the addresses connected to before, the fastest is tried first
+	struct rp_conn_addr_stat addr_stats[RP_DNS_MAX_ADDRS];
+	size_t                   n_addr_stats;
+
+	// connection state
+	enum {
+		RP_CONN_DISCONNECTED = 0,
+		RP_CONN_RESOLVING,
+		RP_CONN_RESOLVED,
+		RP_CONN_CONNECTING,
+		RP_CONN_DRAINING, // connected, the ring still has the buffers
+		RP_CONN_CONNECTED,
+	} state;
+
+	int sock_fd; // socket fd
+
+	unsigned int read_full:1; // whether or not the read buf was full
+	unsigned int write_full:1; // whether or not the write buf was full
+
+	// io_uring backend
+	unsigned int uring:1; // the socket is driven by the ring
+	unsigned int recv_busy:1; // a read is queued
+	struct iovec recv_iov[2]; // of the read in flight
+	unsigned int sends; // sends in flight
+	struct iovec send_iov[RP_EVENT_IOV]; // of the send in flight
+	struct msghdr send_msg;
+	unsigned int uring_ops; // operations in flight, cancelled ones too
+
+	// drop input up to the next crlf, set after a line was too long to
+	// fit into read_buf.
+	unsigned int discard:1;
+
+	// on the ready list of the event context
+	unsigned int    ready:1;
+	struct rp_conn *ready_next;
+
+	struct rp_conn *next;
+};
+
 struct rp_event_ctx;
 
+// report SIGINT in rp_events, only one event context of a process may
+// ask for it.
+#define RP_EVENT_SIGINT 0x1
+
+// drive connected sockets through io_uring, falls back to epoll if the
+// kernel lacks support.
+#define RP_EVENT_URING  0x2
+
+// counters of the event loop, syscalls per byte is what the buffers
+// and the batching are meant to keep low.
+struct rp_event_stats {
+	unsigned long syscalls; // every syscall made for i/o and waiting
+	unsigned long reads; // socket reads, completed ones with io_uring
+	unsigned long writes; // socket writes, completed ones with io_uring
+	unsigned long bytes_in;
+	unsigned long bytes_out;
+};
+
+// events an fd is registered for and that are reported to its handler,
+// every fd is edge triggered.
+#define RP_EVENT_READ  0x1
+#define RP_EVENT_WRITE 0x2
+#define RP_EVENT_ERROR 0x4 // error or hangup, only reported
+
+typedef void (*rp_event_handler_t)(struct rp_event_ctx *ctx, int fd,
+	unsigned events, void *udata);
+
 // initialize the event system.
-int rp_event_init(rp_pool_t *pool, struct rp_config *cfg,
-	rp_fifo_t *read_buf, rp_fifo_t *write_buf, struct rp_event_ctx **ctx);
+int rp_event_init(rp_pool_t *pool, unsigned flags, struct rp_event_ctx **ctx);
+
+// close the sockets of every connection and release the fds and the ring
+// of the event system, the memory goes with the pool.
+void rp_event_destroy(struct rp_event_ctx *ctx);
+
+// add a connection for the network in cfg, it starts connecting on the
+// next poll.
+int rp_event_add_conn(struct rp_event_ctx *ctx, struct rp_config *cfg,
+	rp_fifo_t *read_buf, rp_chain_t *write_buf, struct rp_conn **conn);
+
+// register fd for the events in mask, handler runs from rp_event_poll.
+int rp_event_add(struct rp_event_ctx *ctx, int fd, unsigned mask,
+	rp_event_handler_t handler, void *udata);
 
-// poll for events on the socket, block until an event is received or
-// timeout is reached.
+// change the events of a registered fd, a no-op if mask is unchanged.
+int rp_event_mod(struct rp_event_ctx *ctx, int fd, unsigned mask);
+
+// unregister fd, this has to happen before it is closed. events of it
+// that the running poll has yet to dispatch are dropped, even once the
+// fd number was registered again.
+int rp_event_del(struct rp_event_ctx *ctx, int fd);
+
+// make standby the standby connection of primary, it starts with the
+// next server of the config and avoids the one primary is on.
+void rp_event_pair(struct rp_conn *primary, struct rp_conn *standby);
+
+// close an established connection, it reconnects like one that broke.
+void rp_event_drop(struct rp_event_ctx *ctx, struct rp_conn *conn);
+
+// the list of connections
+struct rp_conn * rp_event_conns(struct rp_event_ctx *ctx);
+
+// the connections that have something to handle, linked by ready_next.
+// these are the ones that had events in the last rp_event_poll and the
+// ones marked with rp_event_ready since, in the order they got ready.
+struct rp_conn * rp_event_ready_conns(struct rp_event_ctx *ctx);
+
+// put a connection on the ready list, for instance after a timer wrote
+// to it. the next rp_event_poll flushes the ready connections and only
+// those, a connection that is not on the list is left alone.
+void rp_event_ready(struct rp_event_ctx *ctx, struct rp_conn *conn);
+
+// the resolver the connections look up their servers with.
+struct rp_dns_ctx * rp_event_dns(struct rp_event_ctx *ctx);
+
+// the timers of the event context, they run from rp_event_poll.
+rp_timer_wheel_t * rp_event_timers(struct rp_event_ctx *ctx);
+
+void rp_event_stats(struct rp_event_ctx *ctx, struct rp_event_stats *stats);
+
+// make a poll that is blocked in another thread return.
+int rp_event_wake(struct rp_event_ctx *ctx);
+
+// write out and read what is left for the ready connections, then poll
+// for events on all sockets and run expired timers. blocks until an
+// event is received, the nearest timer is due or timeout is reached (-1
+// waits for events and timers only). events of a connection are set in
+// its evs and put it on the ready list, which starts out empty.
 int rp_event_poll(struct rp_event_ctx *, struct rp_events *, int timeout);
 
 #endif // RP_EVENT_H
-
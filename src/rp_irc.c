@@ -1,28 +1,135 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
 #include <uthash.h>
 #include <utlist.h>
 #include <rp_irc.h>
+#include <rp_math.h>
 #include <rp_palloc.h>
 #include <rp_ircsm.h>
+#include <rpbot.h>
+
+// membership prefixes until the server sends its own
+#define IRC_DEFAULT_PREFIXES "~&@%+"
+
+// a PING goes out every IRC_PING_INTERVAL ms. a server that has not
+// answered one after IRC_PING_TIMEOUT ms is given up on, a half-open
+// connection would otherwise only be noticed when tcp gives up on it.
+#define IRC_PING_INTERVAL (15 * 1000)
+#define IRC_PING_TIMEOUT  (10 * 1000)
+
+// flood control after rfc 1459 8.10. every line moves the penalty clock
+// of the server IRC_FLOOD_COST ms ahead and a client whose clock runs
+// more than IRC_FLOOD_BURST ms ahead is not read from until it caught
+// up, its input piles up and eventually gets it dropped for flooding.
+// lines are held back before the clock gets there.
+#define IRC_FLOOD_COST  (2 * 1000)
+#define IRC_FLOOD_BURST (10 * 1000)
+
+// unused lines kept for reuse
+#define IRC_FREE_LINES 16
+
+// output lanes. a lane only sends when the ones before it are empty.
+enum {
+	IRC_LANE_URGENT = 0, // keepalive and registration, never held back
+	IRC_LANE_MOD, // channel moderation
+	IRC_LANE_CHAT, // everything else
+	IRC_LANES
+};
+
+struct irc_line {
+	struct irc_line   *next;
+	size_t             len;
+	u_char             data[RP_IRC_LINE_SZ];
+};
+
+// the lines held back for one target, the first middle param. targets
+// with lines take turns a line at a time, so one busy channel can't
+// starve the others.
+struct irc_target {
+	struct irc_target *next; // in the rotation of the lane
+	struct irc_line   *head;
+	struct irc_line   *tail;
+	UT_hash_handle     hh;
+	size_t             len;
+	u_char             name[];
+};
+
+struct irc_lane {
+	struct irc_target *targets; // by name
+	struct irc_target *head; // whose turn it is
+	struct irc_target *tail;
+};
+
+// where we stand in a configured channel, from the last NAMES reply
+struct irc_member {
+	struct rp_config_channel *channel;
+	char                      prefix; // highest membership prefix or 0
+	unsigned int              joined:1;
+};
 
 struct rp_irc_ctx {
 	rp_pool_t              *pool;
 	struct rp_config       *cfg;
-	struct rp_irc_ev_hash  *hash;
-	rp_fifo_t              *write_buf;
+	struct rp_irc_ev_hash  *hash; // handlers for unknown verbs
+	rp_chain_t             *write_buf;
 	struct rp_ircsm_msg     msg;
-	int                     cs;
+	rp_str_t               *nick; // the nick to register with
+
+	unsigned int            registered:1; // 004 was received
+	unsigned int            standby:1;
+
+	// handlers indexed by command id
+	struct rp_irc_ev       *handlers[RP_IRCSM_CMD_MAX];
+
+	// commands that have a handler, everything else is skipped by
+	// the parser.
+	u_char                  interest[RP_IRCSM_INTEREST_SZ];
+
+	// membership prefixes from PREFIX in 005, for rp_ircsm_names_decode
+	char                    prefixes[16];
+
+	// our membership in each configured channel, in config order
+	struct irc_member      *members;
+	size_t                  nmembers;
+
+	// handlers for lines the parser rejected
+	struct rp_irc_ev       *fallback;
+	uintptr_t               malformed; // number of rejected lines
+
+	// handlers that take a whole batch of messages at once
+	struct rp_irc_batch_ev *batch;
+	struct rp_ircsm_msg     msgs[RP_IRC_BATCH_SZ];
+
+	// keepalive, the PING in flight is identified by the msec it was
+	// sent at, 0 if there is none.
+	uintptr_t               ping_sent;
+	uintptr_t               ping_last; // when the last PING went out
+	struct rp_irc_stats     stats;
+
+	// output held back by flood control
+	struct irc_lane         lanes[IRC_LANES];
+	size_t                  n_queued;
+	struct irc_line        *free_lines;
+	size_t                  n_free_lines;
+	uintptr_t               flood_at; // our penalty clock on the server
 };
 
-typedef void (* rp_ev_handler_t)(struct rp_irc_ctx *ctx);
+typedef void (* rp_ev_handler_t)(struct rp_irc_ctx *ctx,
+	struct rp_ircsm_msg *msg);
 
 struct rp_irc_ev {
 	rp_ev_handler_t   handler;
 	struct rp_irc_ev *next;
 };
 
+struct rp_irc_batch_ev {
+	rp_irc_batch_handler_t  handler;
+	struct rp_irc_batch_ev *next;
+};
+
 struct rp_irc_ev_hash {
 	const char       *cmd;
 	struct rp_irc_ev *ev;
@@ -34,39 +141,633 @@ register_handler(struct rp_irc_ctx *ctx, rp_str_t *cmd,
 	rp_ev_handler_t handler)
 {
 	struct rp_irc_ev_hash *ehash;
+	int id;
+
+	struct rp_irc_ev *e = rp_palloc(ctx->pool, sizeof(struct rp_irc_ev));
+	e->handler = handler;
+	e->next = NULL;
+
+	id = rp_ircsm_cmd_lookup(cmd->ptr, cmd->len);
+
+	rp_ircsm_interest_set(ctx->interest, id);
+
+	if (id != RP_IRCSM_CMD_UNKNOWN) {
+		LL_APPEND(ctx->handlers[id], e);
+		return;
+	}
 
 	HASH_FIND(hh, ctx->hash, cmd->ptr, cmd->len, ehash);
 
 	if (!ehash) {
 		ehash = (struct rp_irc_ev_hash *)rp_palloc(ctx->pool, sizeof(struct rp_irc_ev_hash));
 		ehash->cmd = cmd->ptr;
+		ehash->ev = NULL;
 		HASH_ADD_KEYPTR(hh, ctx->hash, ehash->cmd, cmd->len, ehash);
 	}
 
-	struct rp_irc_ev *e = rp_palloc(ctx->pool, sizeof(struct rp_irc_ev));
+	LL_APPEND(ehash->ev, e);
+}
+
+static void
+register_fallback_handler(struct rp_irc_ctx *ctx, rp_ev_handler_t handler)
+{
+	struct rp_irc_ev *e = rp_palloc(ctx->pool, sizeof(*e));
 	e->handler = handler;
 	e->next = NULL;
 
-	LL_APPEND(ehash->ev, e);
+	LL_APPEND(ctx->fallback, e);
+}
+
+void
+rp_irc_register_batch_handler(struct rp_irc_ctx *ctx,
+	rp_irc_batch_handler_t handler)
+{
+	struct rp_irc_batch_ev *e = rp_palloc(ctx->pool, sizeof(*e));
+	e->handler = handler;
+	e->next = NULL;
+
+	LL_APPEND(ctx->batch, e);
+
+	// batch handlers see every message
+	memset(ctx->interest, 0xff, sizeof(ctx->interest));
+}
+
+const u_char *
+rp_irc_interest(struct rp_irc_ctx *ctx)
+{
+	return ctx->interest;
+}
+
+// whether s can be a middle param, one that is not the last one.
+static int
+param_valid(const rp_str_t *s)
+{
+	size_t i;
+
+	if (s->len == 0 || s->ptr[0] == ':') {
+		return 0;
+	}
+
+	for (i = 0; i < s->len; i++) {
+		if (s->ptr[i] == ' ' || s->ptr[i] == '\r' || s->ptr[i] == '\n' ||
+		    s->ptr[i] == '\0') {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// whether s can be the trailing param, it may not end the line early.
+static int
+text_valid(const rp_str_t *s)
+{
+	size_t i;
+
+	for (i = 0; i < s->len; i++) {
+		if (s->ptr[i] == '\r' || s->ptr[i] == '\n' || s->ptr[i] == '\0') {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// how much of text goes on a line with room for max bytes of it. the
+// line breaks after the last space of its second half if there is one,
+// otherwise at the start of a utf-8 sequence. skip is set to the bytes
+// the next line leaves out.
+static size_t
+text_split(const char *text, size_t len, size_t max, size_t *skip)
+{
+	size_t n = max;
+
+	*skip = 0;
+
+	if (len <= max) {
+		return len;
+	}
+
+	while (n > max / 2 && text[n] != ' ') {
+		n--;
+	}
+
+	if (text[n] == ' ') {
+		*skip = 1;
+		return n;
+	}
+
+	// continuation bytes are 10xxxxxx
+	for (n = max; n > 0 && ((u_char)text[n] & 0xc0) == 0x80; n--) {
+		// void
+	}
+
+	// not utf-8 after all, the line is filled up
+	return n > 0 ? n : max;
+}
+
+static int
+cmd_lane(const char *cmd)
+{
+	static const char *urgent[] = {
+		"PONG", "PING", "PASS", "CAP", "AUTHENTICATE", "NICK", "USER",
+		"QUIT", NULL
+	};
+	static const char *mod[] = {
+		"KICK", "MODE", "TOPIC", "INVITE", "KILL", "REMOVE", NULL
+	};
+	size_t i;
+
+	for (i = 0; urgent[i]; i++) {
+		if (strcmp(cmd, urgent[i]) == 0) {
+			return IRC_LANE_URGENT;
+		}
+	}
+
+	for (i = 0; mod[i]; i++) {
+		if (strcmp(cmd, mod[i]) == 0) {
+			return IRC_LANE_MOD;
+		}
+	}
+
+	return IRC_LANE_CHAT;
+}
+
+// whether one more line can go out without the server holding it back
+static int
+flood_ok(struct rp_irc_ctx *ctx)
+{
+	uintptr_t at = rp_max(ctx->flood_at, rp_current_msec);
+
+	return at + IRC_FLOOD_COST <= rp_current_msec + IRC_FLOOD_BURST;
+}
+
+static void
+flood_charge(struct rp_irc_ctx *ctx)
+{
+	ctx->flood_at = rp_max(ctx->flood_at, rp_current_msec) + IRC_FLOOD_COST;
+}
+
+static struct irc_line *
+line_alloc(struct rp_irc_ctx *ctx)
+{
+	struct irc_line *line = ctx->free_lines;
+
+	if (line) {
+		ctx->free_lines = line->next;
+		ctx->n_free_lines--;
+		return line;
+	}
+
+	return rp_alloc(sizeof(*line));
 }
 
 static void
-handle_ping(struct rp_irc_ctx *ctx)
+line_free(struct rp_irc_ctx *ctx, struct irc_line *line)
+{
+	if (ctx->n_free_lines >= IRC_FREE_LINES) {
+		rp_free(line);
+		return;
+	}
+
+	line->next = ctx->free_lines;
+	ctx->free_lines = line;
+	ctx->n_free_lines++;
+}
+
+// hold a line back behind the others of its target. a target that had
+// nothing queued waits for its turn at the end of the rotation.
+static int
+line_queue(struct rp_irc_ctx *ctx, int l, const rp_str_t *name,
+	struct irc_line *line)
+{
+	struct irc_lane *lane = &ctx->lanes[l];
+	struct irc_target *t;
+
+	HASH_FIND(hh, lane->targets, name->ptr, name->len, t);
+
+	if (!t) {
+		if ((t = rp_alloc(sizeof(*t) + name->len)) == NULL) {
+			return -1;
+		}
+
+		memcpy(t->name, name->ptr, name->len);
+		t->len = name->len;
+		t->head = NULL;
+		t->next = NULL;
+		HASH_ADD_KEYPTR(hh, lane->targets, t->name, t->len, t);
+
+		if (lane->tail) {
+			lane->tail->next = t;
+		} else {
+			lane->head = t;
+		}
+
+		lane->tail = t;
+	}
+
+	line->next = NULL;
+
+	if (t->head) {
+		t->tail->next = line;
+	} else {
+		t->head = line;
+	}
+
+	t->tail = line;
+	ctx->n_queued++;
+	ctx->stats.delayed++;
+
+	return 0;
+}
+
+// take the next line of the target whose turn it is and move the target
+// to the end of the rotation, or drop it once it has nothing left.
+static struct irc_line *
+line_dequeue(struct rp_irc_ctx *ctx, struct irc_lane *lane)
+{
+	struct irc_target *t = lane->head;
+	struct irc_line *line = t->head;
+
+	t->head = line->next;
+	lane->head = t->next;
+	t->next = NULL;
+
+	if (!lane->head) {
+		lane->tail = NULL;
+	}
+
+	if (t->head) {
+		if (lane->tail) {
+			lane->tail->next = t;
+		} else {
+			lane->head = t;
+		}
+
+		lane->tail = t;
+	} else {
+		HASH_DEL(lane->targets, t);
+		rp_free(t);
+	}
+
+	ctx->n_queued--;
+
+	return line;
+}
+
+// drop everything that was held back
+static void
+output_reset(struct rp_irc_ctx *ctx)
+{
+	size_t i;
+
+	for (i = 0; i < IRC_LANES; i++) {
+		while (ctx->lanes[i].head) {
+			line_free(ctx, line_dequeue(ctx, &ctx->lanes[i]));
+		}
+	}
+
+	ctx->flood_at = rp_current_msec;
+}
+
+int
+rp_irc_send(struct rp_irc_ctx *ctx, const char *cmd, const rp_str_t *text,
+	...)
+{
+	const rp_str_t *params[RP_IRCSM_MAX_PARAMS];
+	const rp_str_t *param;
+	size_t n_params = 0, cmd_len = strlen(cmd), head = cmd_len, room, off = 0;
+	int lane = cmd_lane(cmd);
+	rp_str_t target;
+	va_list ap;
+
+	va_start(ap, text);
+
+	while ((param = va_arg(ap, const rp_str_t *)) != NULL) {
+		if (n_params == RP_IRCSM_MAX_PARAMS - 1 || !param_valid(param)) {
+			va_end(ap);
+			return -1;
+		}
+
+		params[n_params++] = param;
+		head += 1 + param->len;
+	}
+
+	va_end(ap);
+
+	// cmd, the params and " :" in front of the text, with the crlf
+	if (head + (text ? 2 : 0) + 2 > RP_IRC_LINE_SZ ||
+	    (text && !text_valid(text))) {
+		return -1;
+	}
+
+	room = RP_IRC_LINE_SZ - head - (text ? 2 : 0) - 2;
+
+	if (text && text->len > 0 && room == 0) {
+		return -1;
+	}
+
+	// a standby sends nothing but what keeps its registration alive
+	if (ctx->standby && lane != IRC_LANE_URGENT) {
+		return -1;
+	}
+
+	if (n_params > 0) {
+		target = *params[0];
+	} else {
+		target.ptr = (char *)cmd;
+		target.len = cmd_len;
+	}
+
+	do {
+		size_t i, n = 0, skip = 0;
+		struct irc_line *queued = NULL;
+		u_char *line, *p;
+
+		// a line goes straight into the write buffer unless flood
+		// control holds it back. urgent ones never wait, but still
+		// count against the others.
+		if (lane == IRC_LANE_URGENT || (ctx->n_queued == 0 && flood_ok(ctx))) {
+			line = rp_chain_reserve(ctx->write_buf, RP_IRC_LINE_SZ);
+		} else if (ctx->n_queued < RP_IRC_QUEUE_MAX &&
+		           (queued = line_alloc(ctx)) != NULL) {
+			line = queued->data;
+		} else {
+			line = NULL;
+		}
+
+		if (line == NULL) {
+			return -1;
+		}
+
+		p = line;
+		memcpy(p, cmd, cmd_len);
+		p += cmd_len;
+
+		for (i = 0; i < n_params; i++) {
+			*p++ = ' ';
+			memcpy(p, params[i]->ptr, params[i]->len);
+			p += params[i]->len;
+		}
+
+		if (text) {
+			n = text_split(text->ptr + off, text->len - off, room, &skip);
+
+			*p++ = ' ';
+			*p++ = ':';
+			memcpy(p, text->ptr + off, n);
+			p += n;
+		}
+
+		*p++ = '\r';
+		*p++ = '\n';
+
+		if (queued) {
+			queued->len = (size_t)(p - line);
+
+			if (line_queue(ctx, lane, &target, queued)) {
+				line_free(ctx, queued);
+				return -1;
+			}
+		} else {
+			rp_chain_commit(ctx->write_buf, (size_t)(p - line));
+			flood_charge(ctx);
+		}
+
+		off += n + skip;
+	} while (text && off < text->len);
+
+	return 0;
+}
+
+static void
+handle_ping(struct rp_irc_ctx *ctx, struct rp_ircsm_msg *msg)
 {
 	printf("PING?! PONG\n");
 
-	rp_fifo_putstr(ctx->write_buf, "PONG ");
-	rp_fifo_putstring(ctx->write_buf, &ctx->msg.params);
-	rp_fifo_putstr(ctx->write_buf, "\r\n");
+	if (msg->argc == 0) {
+		return;
+	}
+
+	rp_irc_send(ctx, "PONG", &msg->argv[msg->argc - 1], NULL);
 }
 
+// the answer to a keepalive PING, its token is the msec it was sent at.
 static void
-handle_auth(struct rp_irc_ctx *ctx)
+handle_pong(struct rp_irc_ctx *ctx, struct rp_ircsm_msg *msg)
 {
+	uintptr_t sent = 0;
+	size_t i;
+
+	if (msg->argc == 0 || ctx->ping_sent == 0) {
+		return;
+	}
+
+	rp_str_t *token = &msg->argv[msg->argc - 1];
+
+	for (i = 0; i < token->len; i++) {
+		if (token->ptr[i] < '0' || token->ptr[i] > '9') {
+			return;
+		}
+
+		sent = sent * 10 + (uintptr_t)(token->ptr[i] - '0');
+	}
+
+	if (sent != ctx->ping_sent) {
+		return;
+	}
+
+	ctx->stats.lag = rp_current_msec - sent;
+	ctx->stats.pongs++;
+	ctx->ping_sent = 0;
+}
+
+// a JOIN line, "JOIN <channels> <keys>\r\n"
+struct join_line {
+	char   chans[RP_IRC_LINE_SZ];
+	size_t chans_len;
+	char   keys[RP_IRC_LINE_SZ];
+	size_t keys_len;
+};
+
+static size_t
+join_line_len(size_t chans_len, size_t keys_len)
+{
+	return 5 + chans_len + (keys_len ? 1 + keys_len : 0) + 2;
+}
+
+static void
+join_flush(struct rp_irc_ctx *ctx, struct join_line *l)
+{
+	rp_str_t chans, keys;
+
+	if (l->chans_len == 0) {
+		return;
+	}
+
+	chans.ptr = l->chans;
+	chans.len = l->chans_len;
+	keys.ptr = l->keys;
+	keys.len = l->keys_len;
+
+	if (rp_irc_send(ctx, "JOIN", NULL, &chans, keys.len ? &keys : NULL, NULL)) {
+		fprintf(stderr, "could not queue JOIN\n");
+	}
+
+	l->chans_len = 0;
+	l->keys_len = 0;
+}
+
+// join every configured channel in as few lines as fit into the line
+// limit. channels with a key go first, so the keys line up with them.
+static void
+join_channels(struct rp_irc_ctx *ctx)
+{
+	struct rp_config_channel *ch;
+	struct join_line l;
+	int keyed;
+
+	l.chans_len = 0;
+	l.keys_len = 0;
+
+	for (keyed = 1; keyed >= 0; keyed--) {
+		LL_FOREACH(ctx->cfg->channels, ch) {
+			if ((ch->key.len > 0) != keyed) {
+				continue;
+			}
+
+			size_t chans_len = l.chans_len + (l.chans_len ? 1 : 0) + ch->name.len;
+			size_t keys_len = !keyed ? l.keys_len
+			                : l.keys_len + (l.keys_len ? 1 : 0) + ch->key.len;
+
+			if (join_line_len(chans_len, keys_len) > RP_IRC_LINE_SZ) {
+				join_flush(ctx, &l);
+
+				chans_len = ch->name.len;
+				keys_len = keyed ? ch->key.len : 0;
+
+				if (join_line_len(chans_len, keys_len) > RP_IRC_LINE_SZ) {
+					fprintf(stderr, "channel name too long: %.*s\n",
+					        (int)ch->name.len, ch->name.ptr);
+					continue;
+				}
+			}
+
+			if (l.chans_len) {
+				l.chans[l.chans_len++] = ',';
+			}
+
+			memcpy(l.chans + l.chans_len, ch->name.ptr, ch->name.len);
+			l.chans_len += ch->name.len;
+
+			if (keyed) {
+				if (l.keys_len) {
+					l.keys[l.keys_len++] = ',';
+				}
+
+				memcpy(l.keys + l.keys_len, ch->key.ptr, ch->key.len);
+				l.keys_len += ch->key.len;
+			}
+		}
+	}
+
+	join_flush(ctx, &l);
+}
+
+// registration is done, this also happens again after every reconnect.
+// a standby only stays registered, it joins once it takes over.
+static void
+handle_auth(struct rp_irc_ctx *ctx, struct rp_ircsm_msg *msg)
+{
+	(void)msg;
+
 	printf("handling auth\n");
-	rp_fifo_putstr(ctx->write_buf, "JOIN ");
-	rp_fifo_putstring(ctx->write_buf, &ctx->cfg->channels->name);
-	rp_fifo_putstr(ctx->write_buf, "\r\n");
+	ctx->registered = 1;
+
+	if (!ctx->standby) {
+		join_channels(ctx);
+	}
+}
+
+static void
+handle_isupport(struct rp_irc_ctx *ctx, struct rp_ircsm_msg *msg)
+{
+	struct rp_ircsm_isupport isupport;
+	size_t i;
+
+	if (rp_ircsm_isupport_decode(msg, &isupport)) {
+		return;
+	}
+
+	for (i = 0; i < isupport.count; i++) {
+		struct rp_ircsm_isupport_token *t = &isupport.tokens[i];
+		rp_str_t modes, prefixes;
+
+		if (t->key.len != 6 || memcmp(t->key.ptr, "PREFIX", 6) != 0 ||
+		    rp_ircsm_isupport_prefix(&t->value, &modes, &prefixes) ||
+		    prefixes.len >= sizeof(ctx->prefixes)) {
+			continue;
+		}
+
+		memcpy(ctx->prefixes, prefixes.ptr, prefixes.len);
+		ctx->prefixes[prefixes.len] = '\0';
+	}
+}
+
+static struct irc_member *
+find_member(struct rp_irc_ctx *ctx, const rp_str_t *channel)
+{
+	size_t i;
+
+	for (i = 0; i < ctx->nmembers; i++) {
+		rp_str_t *name = &ctx->members[i].channel->name;
+
+		if (name->len == channel->len &&
+		    strncasecmp(name->ptr, channel->ptr, name->len) == 0) {
+			return &ctx->members[i];
+		}
+	}
+
+	return NULL;
+}
+
+// our own membership in a channel, from the names the server sends. a
+// reply comes in as many lines as it takes and only one of them has us.
+static void
+handle_names(struct rp_irc_ctx *ctx, struct rp_ircsm_msg *msg)
+{
+	struct rp_ircsm_names names;
+	struct irc_member *m;
+	size_t i;
+
+	if (rp_ircsm_names_decode(msg, ctx->prefixes, &names) ||
+	    !(m = find_member(ctx, &names.channel))) {
+		return;
+	}
+
+	for (i = 0; i < names.count; i++) {
+		struct rp_ircsm_name *name = &names.names[i];
+
+		if (name->nick.len != ctx->nick->len ||
+		    strncasecmp(name->nick.ptr, ctx->nick->ptr, name->nick.len) != 0) {
+			continue;
+		}
+
+		m->joined = 1;
+		m->prefix = name->prefix.len ? name->prefix.ptr[0] : 0;
+		break;
+	}
+}
+
+static void
+handle_malformed(struct rp_irc_ctx *ctx, struct rp_ircsm_msg *msg)
+{
+	// leave out the crlf
+	int len = (int)rp_min(msg->line.len - 2, 128);
+
+	fprintf(stderr, "rejected malformed line (%lu so far) at column %d: %.*s\n",
+	        (unsigned long)ctx->malformed,
+	        (int)(msg->error_at - msg->line.ptr), len, msg->line.ptr);
 }
 
 static void
@@ -75,65 +776,329 @@ register_default_handlers(struct rp_irc_ctx *ctx)
 	rp_str_t pingmsg = rp_string("PING");
 	register_handler(ctx, &pingmsg, handle_ping);
 
+	rp_str_t pongmsg = rp_string("PONG");
+	register_handler(ctx, &pongmsg, handle_pong);
+
 	rp_str_t authmsg = rp_string("004");
 	register_handler(ctx, &authmsg, handle_auth);
+
+	rp_str_t isupportmsg = rp_string("005");
+	register_handler(ctx, &isupportmsg, handle_isupport);
+
+	rp_str_t namesmsg = rp_string("353");
+	register_handler(ctx, &namesmsg, handle_names);
+
+	register_fallback_handler(ctx, handle_malformed);
 }
 
 void
-rp_irc_init(rp_pool_t *pool, struct rp_config *cfg, rp_fifo_t *write_buf,
+rp_irc_init(rp_pool_t *pool, struct rp_config *cfg, rp_chain_t *write_buf,
 	struct rp_irc_ctx **ctx)
 {
 	struct rp_irc_ctx *c = rp_palloc(pool, sizeof(*c));
 	memset(c, 0, sizeof(*c));
 
-	rp_ircsm_init(&c->cs);
-	rp_ircsm_msg_init(pool, &c->msg);
+	rp_ircsm_msg_init(&c->msg);
+	c->msg.interest = c->interest;
+
+	size_t i;
+	for (i = 0; i < RP_IRC_BATCH_SZ; i++) {
+		rp_ircsm_msg_init(&c->msgs[i]);
+		c->msgs[i].interest = c->interest;
+	}
+
+	strcpy(c->prefixes, IRC_DEFAULT_PREFIXES);
+
+	struct rp_config_channel *ch;
+	LL_COUNT(cfg->channels, ch, c->nmembers);
+
+	c->members = rp_pcalloc(pool, c->nmembers * sizeof(*c->members));
+	i = 0;
+	LL_FOREACH(cfg->channels, ch) {
+		c->members[i++].channel = ch;
+	}
 
 	c->pool = pool;
 	c->cfg = cfg;
 	c->write_buf = write_buf;
+	c->nick = &cfg->identity.nicks->str;
 
 	register_default_handlers(c);
 
 	*ctx = c;
 }
 
-int
-rp_irc_handle(struct rp_irc_ctx *ctx)
+// run the handlers for n messages, then give the whole batch to the
+// batch handlers. malformed messages go to the fallback handlers.
+static void
+dispatch(struct rp_irc_ctx *ctx, struct rp_ircsm_msg *msgs, size_t n)
 {
 	struct rp_irc_ev_hash *ehash;
-	HASH_FIND(hh, ctx->hash, ctx->msg.code.ptr, ctx->msg.code.len, ehash);
+	struct rp_irc_ev *head, *e;
+	struct rp_irc_batch_ev *b;
+	size_t i;
 
-	if (!ehash) {
-		return 0;
+	for (i = 0; i < n; i++) {
+		struct rp_ircsm_msg *msg = &msgs[i];
+
+		if (msg->is_malformed) {
+			ctx->malformed++;
+			head = ctx->fallback;
+		} else if (msg->cmd != RP_IRCSM_CMD_UNKNOWN) {
+			head = ctx->handlers[msg->cmd];
+		} else {
+			// unknown verbs fall back to a lookup by name
+			HASH_FIND(hh, ctx->hash, msg->code.ptr, msg->code.len, ehash);
+
+			if (!ehash) {
+				continue;
+			}
+
+			head = ehash->ev;
+		}
+
+		LL_FOREACH(head, e) {
+			e->handler(ctx, msg);
+		}
 	}
 
-	struct rp_irc_ev *e;
+	if (ctx->standby) {
+		return;
+	}
 
-	LL_FOREACH(ehash->ev, e) {
-		e->handler(ctx);
+	LL_FOREACH(ctx->batch, b) {
+		b->handler(ctx, msgs, n);
+	}
+}
+
+int
+rp_irc_handle(struct rp_irc_ctx *ctx)
+{
+	if (ctx->msg.is_skipped) {
+		return 0;
 	}
 
+	dispatch(ctx, &ctx->msg, 1);
+
 	return 0;
 }
 
+// the incomplete line at the start of the input is searched by both
+// rp_irc_process, in msgs[0], and rp_irc_parse, in msg. once one of them
+// consumed it the search state of the other no longer fits.
 int
 rp_irc_parse(struct rp_irc_ctx *ctx, const char *src, size_t *len)
 {
-	return rp_ircsm_parse(&ctx->msg, &ctx->cs, src, len);
+	int r = rp_ircsm_parse(&ctx->msg, src, len);
+
+	if (r != RP_IRCSM_AGAIN) {
+		rp_ircsm_scan_reset(&ctx->msgs[0]);
+	}
+
+	return r;
+}
+
+void
+rp_irc_drop_line(struct rp_irc_ctx *ctx)
+{
+	rp_ircsm_scan_reset(&ctx->msg);
+	rp_ircsm_scan_reset(&ctx->msgs[0]);
+}
+
+size_t
+rp_irc_process(struct rp_irc_ctx *ctx, const char *src, size_t *len)
+{
+	size_t total = 0;
+	size_t off = 0;
+
+	while (off < *len) {
+		size_t l = *len - off;
+		size_t n = rp_ircsm_parse_batch(ctx->msgs, RP_IRC_BATCH_SZ,
+		                                src + off, &l);
+
+		// skipped messages are consumed without taking up a slot
+		off += l;
+
+		if (n > 0) {
+			dispatch(ctx, ctx->msgs, n);
+			total += n;
+		}
+
+		// a short batch means the rest is an incomplete message
+		if (n < RP_IRC_BATCH_SZ) {
+			break;
+		}
+	}
+
+	if (off > 0) {
+		rp_ircsm_scan_reset(&ctx->msg);
+	}
+
+	*len = off;
+
+	return total;
 }
 
 int
 rp_irc_onconnect(struct rp_irc_ctx *ctx)
 {
-	rp_fifo_putstr(ctx->write_buf, "NICK ");
-	rp_fifo_putstring(ctx->write_buf, &ctx->cfg->identity.nicks->str);
-	rp_fifo_putstr(ctx->write_buf, "\r\nUSER ");
-	rp_fifo_putstring(ctx->write_buf, &ctx->cfg->identity.login);
-	rp_fifo_putstr(ctx->write_buf, " 8 * :");
-	rp_fifo_putstring(ctx->write_buf, &ctx->cfg->identity.name);
-	rp_fifo_putstr(ctx->write_buf, "\r\n");
+	// the new server announces its own
+	strcpy(ctx->prefixes, IRC_DEFAULT_PREFIXES);
+
+	size_t i;
+	for (i = 0; i < ctx->nmembers; i++) {
+		ctx->members[i].joined = 0;
+		ctx->members[i].prefix = 0;
+	}
+
+	// a PING of the old connection will never be answered
+	ctx->ping_sent = 0;
+	ctx->ping_last = rp_current_msec;
+	ctx->registered = 0;
+
+	// what was held back was meant for the old connection
+	output_reset(ctx);
+
+	// the read buffer starts out empty again
+	rp_irc_drop_line(ctx);
+
+	rp_str_t mode = rp_string("8");
+	rp_str_t unused = rp_string("*");
+
+	if (rp_irc_send(ctx, "NICK", NULL, ctx->nick, NULL) ||
+	    rp_irc_send(ctx, "USER", &ctx->cfg->identity.name,
+	                &ctx->cfg->identity.login, &mode, &unused, NULL)) {
+		fprintf(stderr, "could not queue the registration\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+rp_irc_set_nick(struct rp_irc_ctx *ctx, rp_str_t *nick)
+{
+	ctx->nick = nick;
+}
+
+void
+rp_irc_set_standby(struct rp_irc_ctx *ctx, int standby)
+{
+	int promoted = ctx->standby && !standby;
+
+	ctx->standby = standby != 0;
+
+	// the channels were left to the active connection until now
+	if (promoted && ctx->registered) {
+		join_channels(ctx);
+	}
+}
+
+int
+rp_irc_registered(struct rp_irc_ctx *ctx)
+{
+	return ctx->registered;
+}
+
+int
+rp_irc_membership(struct rp_irc_ctx *ctx, const rp_str_t *channel)
+{
+	struct irc_member *m = find_member(ctx, channel);
+
+	if (!m || !m->joined) {
+		return -1;
+	}
+
+	return (unsigned char)m->prefix;
+}
+
+int
+rp_irc_keepalive(struct rp_irc_ctx *ctx, uintptr_t *next)
+{
+	if (ctx->ping_sent) {
+		if (rp_current_msec - ctx->ping_sent >= IRC_PING_TIMEOUT) {
+			return -1;
+		}
+
+		*next = ctx->ping_sent + IRC_PING_TIMEOUT;
+
+		return 0;
+	}
+
+	if (rp_current_msec - ctx->ping_last < IRC_PING_INTERVAL) {
+		*next = ctx->ping_last + IRC_PING_INTERVAL;
+		return 0;
+	}
+
+	char buf[32];
+	rp_str_t token;
+
+	token.ptr = buf;
+	token.len = (size_t)snprintf(buf, sizeof(buf), "%lu",
+	                             (unsigned long)rp_current_msec);
+
+	// try again once there is memory for it
+	if (rp_irc_send(ctx, "PING", &token, NULL)) {
+		*next = rp_current_msec + 1000;
+		return 0;
+	}
+
+	ctx->ping_sent = rp_current_msec;
+	ctx->ping_last = rp_current_msec;
+	ctx->stats.pings++;
+	*next = rp_current_msec + IRC_PING_TIMEOUT;
+
+	return 0;
+}
+
+void
+rp_irc_stats(struct rp_irc_ctx *ctx, struct rp_irc_stats *stats)
+{
+	*stats = ctx->stats;
+}
+
+int
+rp_irc_flush(struct rp_irc_ctx *ctx, uintptr_t *next)
+{
+	struct irc_line *line;
+	size_t i;
+
+	for (i = 0; i < IRC_LANES; i++) {
+		struct irc_lane *lane = &ctx->lanes[i];
+
+		while (lane->head) {
+			if (!flood_ok(ctx)) {
+				*next = ctx->flood_at + IRC_FLOOD_COST - IRC_FLOOD_BURST;
+				return 1;
+			}
+
+			line = lane->head->head;
+
+			// try again once there is memory for it
+			if (rp_chain_put(ctx->write_buf, line->data, line->len)) {
+				*next = rp_current_msec + 1000;
+				return 1;
+			}
+
+			flood_charge(ctx);
+			line_free(ctx, line_dequeue(ctx, lane));
+		}
+	}
 
 	return 0;
 }
 
+void
+rp_irc_destroy(struct rp_irc_ctx *ctx)
+{
+	struct irc_line *line;
+
+	output_reset(ctx);
+
+	while ((line = ctx->free_lines) != NULL) {
+		ctx->free_lines = line->next;
+		rp_free(line);
+	}
+
+	ctx->n_free_lines = 0;
+}
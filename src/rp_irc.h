@@ -2,18 +2,105 @@
 #define RP_IRC_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <rp_config.h>
 #include <rp_palloc.h>
-#include <rp_fifo.h>
+#include <rp_chain.h>
+#include <rp_ircsm.h>
+
+// number of messages parsed and dispatched together by rp_irc_process
+#define RP_IRC_BATCH_SZ 64
+
+// the longest line that may be sent, crlf included
+#define RP_IRC_LINE_SZ 512
+
+// lines held back at most, rp_irc_send fails beyond that
+#define RP_IRC_QUEUE_MAX 1024
 
 struct rp_irc_ctx;
 
+// keepalive and output counters of a connection
+struct rp_irc_stats {
+	uintptr_t lag; // msec between the last answered PING and its PONG
+	uintptr_t pings; // PINGs sent
+	uintptr_t pongs; // PINGs answered
+	uintptr_t delayed; // lines held back by flood control
+};
+
+// handler that receives every message of a batch in a single call
+typedef void (* rp_irc_batch_handler_t)(struct rp_irc_ctx *ctx,
+	struct rp_ircsm_msg *msgs, size_t n);
+
 void rp_irc_init(rp_pool_t *pool, struct rp_config *cfg,
-	rp_fifo_t *write_buf, struct rp_irc_ctx **ctx);
+	rp_chain_t *write_buf, struct rp_irc_ctx **ctx);
+
+void rp_irc_register_batch_handler(struct rp_irc_ctx *ctx,
+	rp_irc_batch_handler_t handler);
+
+// the commands that have a handler, as an interest set for the parser.
+const u_char * rp_irc_interest(struct rp_irc_ctx *ctx);
 
 int rp_irc_parse(struct rp_irc_ctx *ctx, const char *src, size_t *len);
 int rp_irc_handle(struct rp_irc_ctx *ctx);
+
+// parse and handle every complete message in src. returns the number of
+// messages handled and sets len to the number of bytes consumed, which
+// includes skipped messages.
+size_t rp_irc_process(struct rp_irc_ctx *ctx, const char *src, size_t *len);
+
+// the caller dropped the incomplete line at the start of the input, the
+// next call starts with another one.
+void rp_irc_drop_line(struct rp_irc_ctx *ctx);
+
+// queue "cmd param... :text\r\n", the middle params are a NULL
+// terminated list of rp_str_t pointers and text may be NULL. text that
+// does not fit into RP_IRC_LINE_SZ is split into as many lines as it
+// takes, at a space where there is one and never inside of a utf-8
+// sequence. every line is queued whole or not at all. returns -1 if a
+// param can't be sent, memory ran out or a standby was asked for more
+// than keepalive and registration.
+//
+// lines go to the write buffer right away while flood control allows,
+// the rest wait for rp_irc_flush. keepalive and registration never
+// wait, moderation goes before anything else that is held back, and
+// the targets of a kind take turns.
+int rp_irc_send(struct rp_irc_ctx *ctx, const char *cmd, const rp_str_t *text,
+	...);
+
+// register with the server, on every new connection.
 int rp_irc_onconnect(struct rp_irc_ctx *ctx);
 
+// register as nick instead of the first nick of the identity.
+void rp_irc_set_nick(struct rp_irc_ctx *ctx, rp_str_t *nick);
+
+// a standby stays registered but joins no channels, sends nothing but
+// keepalive and registration lines, and the messages it receives are
+// kept from the batch handlers. taking a registered standby out of it
+// joins the channels.
+void rp_irc_set_standby(struct rp_irc_ctx *ctx, int standby);
+
+// whether the server has welcomed us on the current connection.
+int rp_irc_registered(struct rp_irc_ctx *ctx);
+
+// our membership in a configured channel as of the last NAMES reply on
+// the current connection. -1 if we are not in it, else the highest
+// membership prefix we have there, like '@', or 0 for none.
+int rp_irc_membership(struct rp_irc_ctx *ctx, const rp_str_t *channel);
+
+// probe the server with a PING when one is due. returns -1 once the
+// last one went unanswered for too long and the connection should be
+// given up, next is set to when this wants to run again.
+int rp_irc_keepalive(struct rp_irc_ctx *ctx, uintptr_t *next);
+
+void rp_irc_stats(struct rp_irc_ctx *ctx, struct rp_irc_stats *stats);
+
+// move held back lines into the write buffer as far as flood control
+// allows. returns 1 while lines are left, next is then set to when the
+// next one may go out.
+int rp_irc_flush(struct rp_irc_ctx *ctx, uintptr_t *next);
+
+// free the lines that are held back.
+void rp_irc_destroy(struct rp_irc_ctx *ctx);
+
 #endif // RP_IRC_H
 
@@ -1,27 +1,81 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <rp_os.h>
 #include <rp_options.h>
 
+#define RP_WRITE_HIGH (64 * 1024)
+
 static void
 usage(void)
 {
 	printf("\n");
-	printf("Usage: rpbot [OPTIONS] [CONFIG]\n\n");
+	printf("Usage: rpbot [OPTIONS] CONFIG...\n\n");
+	printf("  -t THREADS  run THREADS event loops, 0 for one per cpu\n");
+	printf("  -u          use io_uring for socket i/o if available\n");
+	printf("  -d FILE     keep the dns cache in FILE, every further loop\n");
+	printf("              keeps its own in FILE.N (default memory only)\n");
+	printf("  -r ADDR     ask the nameserver at ADDR[#PORT]\n");
+	printf("  -s          keep a standby connection to every network,\n");
+	printf("              registered with the second nick\n");
+	printf("  -w BYTES    hold back input while BYTES wait to be sent\n");
+	printf("              (default %d)\n", RP_WRITE_HIGH);
+	printf("  -h          show this help\n\n");
 }
 
 int
-rp_parse_opts(int argc, const char **argv, const char **config)
+rp_parse_opts(int argc, const char **argv, struct rp_options *opts)
 {
-	(void)argc;
-	(void)argv;
-	(void)config;
+	int c;
+
+	memset(opts, 0, sizeof(*opts));
+	opts->write_high = RP_WRITE_HIGH;
+
+	while ((c = getopt(argc, (char * const *)argv, "t:ud:r:sw:h")) != -1) {
+		switch (c) {
+		case 't':
+			opts->threads = strtoul(optarg, NULL, 10);
+
+			if (opts->threads == 0) {
+				opts->threads = rp_ncpu;
+			}
+
+			break;
+		case 'u':
+			opts->uring = 1;
+			break;
+		case 'd':
+			opts->dns_cache = optarg;
+			break;
+		case 'r':
+			opts->nameserver = optarg;
+			break;
+		case 's':
+			opts->standby = 1;
+			break;
+		case 'w':
+			opts->write_high = strtoul(optarg, NULL, 10);
 
-	if (argc < 2) {
+			if (opts->write_high == 0) {
+				usage();
+				return 1;
+			}
+
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
 		usage();
 		return 1;
 	}
 
-	*config = argv[1];
+	opts->configs = &argv[optind];
+	opts->n_configs = (size_t)(argc - optind);
 
 	return 0;
 }
-
@@ -1,7 +1,34 @@
 #ifndef RP_OPTIONS_H
 #define RP_OPTIONS_H
 
-int rp_parse_opts(int argc, const char **argv, const char **config);
+#include <stddef.h>
 
-#endif // RP_OPTIONS_H
+struct rp_options {
+	// every config argument describes one network, points into argv.
+	const char **configs;
+	size_t       n_configs;
+
+	// number of event loop threads, 0 runs the loop on the main thread.
+	unsigned     threads;
+
+	// drive sockets through io_uring
+	unsigned     uring:1;
+
+	// keep a second connection per network registered for failover
+	unsigned     standby:1;
+
+	// where resolved names are kept across restarts, NULL or "" for
+	// nowhere. loops after the first add their id to it.
+	const char  *dns_cache;
 
+	// ADDR[#PORT] of the nameserver to ask instead of resolv.conf
+	const char  *nameserver;
+
+	// bytes waiting to be sent at which a connection stops handling
+	// its input
+	size_t       write_high;
+};
+
+int rp_parse_opts(int argc, const char **argv, struct rp_options *opts);
+
+#endif // RP_OPTIONS_H
@@ -1,103 +1,656 @@
 #include <stdio.h>
 #include <string.h>
-#include <sys/time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
 #include <rp_os.h>
+#include <rp_math.h>
 #include <rp_fifo.h>
+#include <rp_chain.h>
+#include <rp_scan.h>
 #include <rp_slab.h>
+#include <rp_chash.h>
 #include <rp_palloc.h>
 #include <rp_options.h>
 #include <rpbot.h>
 #include <rp_event.h>
+#include <rp_dns.h>
 #include <rp_irc.h>
 #include <rp_config.h>
+#include <utlist.h>
 
-#define TIMEOUT 500
+__thread uintptr_t rp_current_msec;
 
-uintptr_t rp_current_msec;
+// the lag of a connection is reported at most every LAG_REPORT_INTERVAL
+// ms, and only once a PONG came in since the last report
+#define LAG_REPORT_INTERVAL (60 * 1000)
+
+// an event loop and the connections it owns. with more than one loop
+// every loop runs on its own thread and shares nothing with the others
+// but the configs, which are read only once the loops are running.
+struct rp_loop {
+	unsigned             id;
+	pthread_t            thread;
+	rp_pool_t           *pool;
+	struct rp_event_ctx *ev_ctx;
+	char                *line_buf; // messages that cross the end of read_buf
+	size_t               n_conns;
+
+	// the chunks of the write buffers and how much a write buffer may
+	// hold before the input of its connection is held back
+	rp_chain_free_t      chunks;
+	size_t               write_high;
+};
+
+struct rp_network;
+
+// a connection of a network and the timer that keeps it alive.
+struct rp_link {
+	struct rp_loop    *loop;
+	struct rp_network *net;
+	struct rp_conn    *conn;
+	rp_timer_t         keepalive;
+	rp_timer_t         output; // armed while flood control holds lines
+	uintptr_t          reported; // when the lag was last reported
+	uintptr_t          pongs; // PONGs counted by the last report
+};
+
+// a network of a loop. with a standby it has a second connection that
+// is registered on another server and takes over the duties of the
+// active one the moment that one drops.
+struct rp_network {
+	struct rp_link links[2];
+	unsigned       n_links;
+	unsigned       active; // the link whose messages are handled
+};
 
 struct rp_ctx {
 	rp_pool_t        *pool;
-	struct rp_config  cfg;
-	rp_fifo_t        *read_buf;
-	rp_fifo_t        *write_buf;
+	struct rp_config *cfgs; // one config per network
+	size_t            n_cfgs;
+
+	struct rp_loop   *loops;
+	unsigned          n_loops;
+	unsigned          threaded:1;
+	unsigned          uring:1;
+	unsigned          standby:1; // a standby connection per network
+
+	const char       *dns_cache; // NULL keeps the cache in memory only
+	const char       *nameserver; // NULL asks the ones of resolv.conf
+	size_t            write_high;
 };
 
-// update rp_current_msec with the current time.
-static void
+// set by the main thread to stop the event loop threads.
+static int rp_stop;
+
+// the coarse clock is read without a syscall and is good to a few ms,
+// which is all the timers need.
+void
 rp_updatetime(void)
 {
-	struct timeval tv;
-	time_t sec;
-	uintptr_t msec;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	rp_current_msec = (uintptr_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-	gettimeofday(&tv, NULL);
+// chunks of the write buffers a loop keeps for reuse, 1M with 4k pages
+#define IRC_FREE_CHUNKS 256
 
-	sec = tv.tv_sec;
-	msec = tv.tv_usec / 1000;
+// the read buffer has to hold a whole message, and with ircv3 tags a
+// message can be 8k of tags plus 512 bytes of the rest.
+#define IRC_READ_BUFFER_SZ (16 * 1024)
 
-	rp_current_msec = (uintptr_t)sec * 1000 + msec;
+// drop the rest of an overlong line. returns 0 if more data is needed.
+static int
+discard_line(struct rp_conn *conn)
+{
+	void *v;
+	size_t n = rp_fifo_raw_r(conn->read_buf, &v);
+	const char *p = v;
+	const char *eol = rp_scan_crlf(p, n);
+
+	if (eol != NULL) {
+		rp_fifo_consume(conn->read_buf, (size_t)(eol - p) + 2);
+		conn->discard = 0;
+		return 1;
+	}
+
+	if (p[n - 1] != '\r') {
+		rp_fifo_consume(conn->read_buf, n);
+		return 1;
+	}
+
+	// a trailing '\r' may be the start of the crlf
+	if (n > 1) {
+		rp_fifo_consume(conn->read_buf, n - 1);
+		return 1;
+	}
+
+	char crlf[2];
+
+	if (rp_fifo_peek(conn->read_buf, crlf, sizeof(crlf)) < sizeof(crlf)) {
+		return 0;
+	}
+
+	if (crlf[1] == '\n') {
+		rp_fifo_consume(conn->read_buf, 2);
+		conn->discard = 0;
+	} else {
+		rp_fifo_consume(conn->read_buf, 1);
+	}
+
+	return 1;
 }
 
-#define IRC_BUFFER_SZ 2048
+// handle every complete message in the read buffer of a connection.
+// while the replies can't be sent as fast as they are made the input
+// waits, a full read buffer then stops reading from the socket and the
+// server is pushed back on.
+static void
+process_input(struct rp_loop *loop, struct rp_conn *conn)
+{
+	while (rp_fifo_count(conn->read_buf) > 0 && !rp_chain_full(conn->write_buf)) {
+		void *p;
+		size_t count = rp_fifo_count(conn->read_buf);
+		size_t n = rp_fifo_raw_r(conn->read_buf, &p);
+		size_t len = n;
+
+		if (conn->discard) {
+			if (!discard_line(conn)) {
+				break;
+			}
+
+			continue;
+		}
+
+		// handle every complete message in the contiguous part
+		// of the buffer and give the space back in one go.
+		rp_irc_process(conn->irc, p, &len);
+
+		if (len > 0) {
+			rp_fifo_consume(conn->read_buf, len);
+			continue;
+		}
+
+		if (n < count) {
+			// the message crosses the end of a plain ring, this
+			// is the only case where it gets copied.
+			len = rp_fifo_peek(conn->read_buf, loop->line_buf, count);
+
+			if (rp_irc_parse(conn->irc, loop->line_buf, &len)) {
+				rp_irc_handle(conn->irc);
+				rp_fifo_consume(conn->read_buf, len);
+				continue;
+			}
+		}
+
+		// a message that does not fit into the buffer can never
+		// be completed, drop it along with the rest of the line.
+		if (rp_fifo_bytes_free(conn->read_buf) == 0) {
+			fprintf(stderr, "dropping line longer than %lu bytes\n",
+			        (unsigned long)conn->read_buf->capacity);
+			rp_fifo_consume(conn->read_buf, count);
+			rp_irc_drop_line(conn->irc);
+			conn->discard = 1;
+		}
+
+		break;
+	}
+}
+
+// report the lag and output counters of a connection now and then, so
+// a slow server shows up before it is given up on.
+static void
+report_lag(struct rp_link *link)
+{
+	struct rp_irc_stats stats;
+
+	rp_irc_stats(link->conn->irc, &stats);
+
+	if (stats.pongs == link->pongs ||
+	    rp_current_msec - link->reported < LAG_REPORT_INTERVAL) {
+		return;
+	}
+
+	fprintf(stderr, "%s lag %lu ms (%lu/%lu PINGs answered, "
+	        "%lu lines delayed)\n", link->conn->host,
+	        (unsigned long)stats.lag, (unsigned long)stats.pongs,
+	        (unsigned long)stats.pings, (unsigned long)stats.delayed);
+
+	link->reported = rp_current_msec;
+	link->pongs = stats.pongs;
+}
+
+// PING the server of a connection while it is connected and give up on
+// it once it stops answering.
+static void
+keepalive_handler(rp_timer_t *timer)
+{
+	struct rp_link *link = timer->data;
+	struct rp_conn *conn = link->conn;
+	uintptr_t       next;
+
+	// armed again on the next connect
+	if (conn->state != RP_CONN_CONNECTED) {
+		return;
+	}
+
+	// before the next PING goes out, so it is not counted as unanswered
+	report_lag(link);
 
+	if (rp_irc_keepalive(conn->irc, &next)) {
+		fprintf(stderr, "%s stopped answering PINGs\n", conn->host);
+		rp_event_drop(link->loop->ev_ctx, conn);
+		return;
+	}
+
+	// a PING may have been written
+	rp_event_ready(link->loop->ev_ctx, conn);
+	rp_timer_add(rp_event_timers(link->loop->ev_ctx), timer, next);
+}
+
+// send what flood control held back on a connection, and come back
+// when the next line is allowed to go.
+static void
+output_handler(rp_timer_t *timer)
+{
+	struct rp_link *link = timer->data;
+	struct rp_conn *conn = link->conn;
+	uintptr_t       next;
+
+	if (conn->state != RP_CONN_CONNECTED) {
+		return;
+	}
+
+	rp_event_ready(link->loop->ev_ctx, conn);
+
+	if (rp_irc_flush(conn->irc, &next)) {
+		rp_timer_add(rp_event_timers(link->loop->ev_ctx), timer, next);
+	}
+}
+
+// a mirrored buffer, so messages and socket i/o never split at the
+// wrap, or a plain one from the pool if memfd is not available.
+static rp_fifo_t *
+create_buf(rp_pool_t *pool, size_t capacity)
+{
+	rp_fifo_t *buf = rp_fifo_create_mirrored(capacity);
+
+	if (buf) {
+		return buf;
+	}
+
+	buf = rp_palloc(pool, sizeof(*buf) + capacity);
+	if (!buf) {
+		return NULL;
+	}
+
+	buf->capacity = capacity;
+	rp_fifo_init(buf);
+
+	return buf;
+}
+
+static void
+destroy_buf(rp_fifo_t *buf)
+{
+	if (rp_fifo_mirrored(buf)) {
+		rp_fifo_destroy_mirrored(buf);
+	}
+}
+
+// allocate the buffers of a connection and add it to its network.
+static struct rp_link *
+add_link(struct rp_loop *loop, struct rp_network *net, struct rp_config *cfg)
+{
+	rp_fifo_t      *read_buf;
+	rp_chain_t     *write_buf;
+	struct rp_conn *conn;
+	struct rp_link *link;
+
+	read_buf = create_buf(loop->pool, IRC_READ_BUFFER_SZ);
+	if (!read_buf) {
+		return NULL;
+	}
+
+	write_buf = rp_palloc(loop->pool, sizeof(*write_buf));
+	if (!write_buf) {
+		return NULL;
+	}
+
+	rp_chain_init(write_buf, &loop->chunks, loop->write_high);
+
+	if (rp_event_add_conn(loop->ev_ctx, cfg, read_buf, write_buf, &conn)) {
+		return NULL;
+	}
+
+	link = &net->links[net->n_links++];
+	link->loop = loop;
+	link->net = net;
+	link->conn = conn;
+	rp_timer_init(&link->keepalive, keepalive_handler, link);
+	rp_timer_init(&link->output, output_handler, link);
+	conn->data = link;
+
+	rp_irc_init(loop->pool, cfg, write_buf, &conn->irc);
+	loop->n_conns++;
+
+	return link;
+}
+
+// add the connection of a network and its standby if asked for. the
+// standby registers with the second nick of the identity.
 static int
-main_loop(struct rp_ctx *ctx)
+add_network(struct rp_loop *loop, struct rp_config *cfg, int standby)
 {
-	struct rp_irc_ctx   *irc_ctx;
-	struct rp_event_ctx *ev_ctx;
+	struct rp_network *net;
+	struct rp_link    *primary, *link;
+
+	net = rp_pcalloc(loop->pool, sizeof(*net));
+	if (!net) {
+		return -1;
+	}
+
+	if (!(primary = add_link(loop, net, cfg))) {
+		return -1;
+	}
+
+	if (!standby) {
+		return 0;
+	}
+
+	if (!cfg->identity.nicks || !cfg->identity.nicks->next) {
+		fprintf(stderr, "a standby needs a second nick in identity.nicks\n");
+		return -1;
+	}
+
+	if (!(link = add_link(loop, net, cfg))) {
+		return -1;
+	}
+
+	rp_irc_set_nick(link->conn->irc, &cfg->identity.nicks->next->str);
+	rp_irc_set_standby(link->conn->irc, 1);
+	rp_event_pair(primary->conn, link->conn);
+
+	return 0;
+}
+
+// hand the duties of a network to its other connection when the active
+// one is gone and the other is registered. the promoted connection joins
+// the channels, the demoted one stays out of them when it comes back.
+static void
+failover(struct rp_network *net)
+{
+	struct rp_conn *active = net->links[net->active].conn;
+	struct rp_conn *other = net->links[!net->active].conn;
+
+	if (net->n_links < 2 ||
+	    (active->state == RP_CONN_CONNECTED && rp_irc_registered(active->irc)) ||
+	    other->state != RP_CONN_CONNECTED || !rp_irc_registered(other->irc)) {
+		return;
+	}
+
+	rp_irc_set_standby(active->irc, 1);
+	rp_irc_set_standby(other->irc, 0);
+	net->active = !net->active;
+
+	// the JOINs of the promoted connection
+	rp_event_ready(other->ev, other);
+
+	fprintf(stderr, "%s took over from %s\n", other->host, active->host);
+}
+
+// the key a network is sharded by, its first nick and server, so the
+// same identity lands on the same loop no matter how the configs are
+// ordered on the command line.
+static unsigned
+network_loop(rp_chash_t *ring, struct rp_config *cfg)
+{
+	u_char key[512];
+	size_t len = 0;
+
+	if (cfg->identity.nicks) {
+		rp_str_t *nick = &cfg->identity.nicks->str;
+
+		len = rp_min(nick->len, sizeof(key) / 2);
+		memcpy(key, nick->ptr, len);
+	}
 
-	rp_event_init(ctx->pool, &ctx->cfg, ctx->read_buf, ctx->write_buf, &ev_ctx);
-	rp_irc_init(ctx->pool, &ctx->cfg, ctx->write_buf, &irc_ctx);
+	key[len++] = '@';
 
-	while (1) {
+	if (cfg->servers) {
+		rp_str_t *host = &cfg->servers->host;
+		size_t n = rp_min(host->len, sizeof(key) - len);
+
+		memcpy(key + len, host->ptr, n);
+		len += n;
+	}
+
+	return rp_chash_lookup(ring, key, len);
+}
+
+static int
+main_loop(struct rp_loop *loop)
+{
+	struct rp_conn *conn;
+
+	while (!__atomic_load_n(&rp_stop, __ATOMIC_ACQUIRE)) {
 		struct rp_events evs;
 		memset(&evs, 0, sizeof(evs));
 
-		rp_updatetime();
-		int r = rp_event_poll(ev_ctx, &evs, TIMEOUT);
+		int r = rp_event_poll(loop->ev_ctx, &evs, -1);
 
 		if (r < 0) {
 			return -1;
 		} else if (r > 0) {
-			if (evs.connected) {
-				fprintf(stderr, "connected to host\n");
-				rp_irc_onconnect(irc_ctx);
-			}
-
-			if (evs.disconnected) {
-				fprintf(stderr, "disconnected from host\n");
-			}
-
 			if (evs.sig_int) {
 				fprintf(stderr, "SIGINT received, terminating...\n");
 				return -1;
 			}
 		}
 
-		while (rp_fifo_count(ctx->read_buf) > 0) {
-			void *p;
-			size_t len = rp_fifo_raw_r(ctx->read_buf, &p);
+		// the connections without events are left alone, a wakeup
+		// costs the same with one connection as with thousands.
+		for (conn = rp_event_ready_conns(loop->ev_ctx); conn;
+		     conn = conn->ready_next) {
+			struct rp_link *link = conn->data;
 
-			if (rp_irc_parse(irc_ctx, p, &len)) {
-				rp_irc_handle(irc_ctx);
+			if (conn->evs.connected) {
+				fprintf(stderr, "connected to %s\n", conn->host);
+				rp_irc_onconnect(conn->irc);
+				keepalive_handler(&link->keepalive);
 			}
 
-			rp_fifo_consume(ctx->read_buf, len);
+			if (conn->evs.disconnected) {
+				struct rp_irc_stats stats;
+
+				rp_irc_stats(conn->irc, &stats);
+				rp_timer_del(rp_event_timers(loop->ev_ctx), &link->keepalive);
+				rp_timer_del(rp_event_timers(loop->ev_ctx), &link->output);
+				fprintf(stderr, "disconnected from %s (lag %lu ms)\n",
+				        conn->host, (unsigned long)stats.lag);
+			}
+
+			process_input(loop, conn);
+
+			// while the timer is armed nothing can go before it
+			if (!rp_timer_active(&link->output)) {
+				output_handler(&link->output);
+			}
+
+			failover(link->net);
 		}
 	}
 
 	return 0;
 }
 
+static void *
+loop_thread(void *arg)
+{
+	struct rp_loop *loop = arg;
+
+	rp_updatetime();
+	main_loop(loop);
+
+	return NULL;
+}
+
+// the loops share nothing, so each one writes its cache to a file of
+// its own. the first one uses path as it is, the others add their id.
+// a network stays on the same loop as long as the number of loops does
+// not change, and so finds its names in the same file again.
+static int
+dns_cache_init(struct rp_loop *loop, struct rp_dns_ctx *dns, const char *path)
+{
+	size_t      size = strlen(path) + 12;
+	const char *file = path;
+	char       *buf;
+
+	if (loop->id > 0) {
+		if (!(buf = rp_palloc(loop->pool, size))) {
+			return -1;
+		}
+
+		snprintf(buf, size, "%s.%u", path, loop->id);
+		file = buf;
+	}
+
+	if (rp_dns_cache_file(dns, file)) {
+		perror(file);
+	}
+
+	return 0;
+}
+
+// create the loops and hand every network to one of them. all event
+// contexts are set up here on the main thread, their signal masks are
+// inherited by the threads started afterwards.
+static int
+rp_loops_init(struct rp_ctx *ctx)
+{
+	rp_chash_t ring;
+	unsigned   i, flags;
+	size_t     n;
+
+	ctx->loops = rp_pcalloc(ctx->pool, ctx->n_loops * sizeof(*ctx->loops));
+	if (!ctx->loops) {
+		return -1;
+	}
+
+	// a single loop runs on the main thread and handles SIGINT itself
+	flags = ctx->threaded ? 0 : RP_EVENT_SIGINT;
+
+	if (ctx->uring) {
+		flags |= RP_EVENT_URING;
+	}
+
+	for (i = 0; i < ctx->n_loops; i++) {
+		struct rp_loop *loop = &ctx->loops[i];
+
+		loop->id = i;
+		loop->pool = rp_create_pool(RP_DEFAULT_POOL_SIZE);
+		if (!loop->pool) {
+			return -1;
+		}
+
+		loop->line_buf = rp_palloc(loop->pool, IRC_READ_BUFFER_SZ);
+		if (!loop->line_buf) {
+			return -1;
+		}
+
+		rp_chain_free_init(&loop->chunks, IRC_FREE_CHUNKS);
+		loop->write_high = ctx->write_high;
+
+		rp_event_init(loop->pool, flags, &loop->ev_ctx);
+
+		struct rp_dns_ctx *dns = rp_event_dns(loop->ev_ctx);
+
+		if (ctx->nameserver && rp_dns_nameserver(dns, ctx->nameserver)) {
+			fprintf(stderr, "invalid nameserver %s\n", ctx->nameserver);
+			return 1;
+		}
+
+		if (ctx->dns_cache && dns_cache_init(loop, dns, ctx->dns_cache)) {
+			return -1;
+		}
+	}
+
+	if (rp_chash_init(ctx->pool, &ring, ctx->n_loops)) {
+		return -1;
+	}
+
+	for (n = 0; n < ctx->n_cfgs; n++) {
+		i = network_loop(&ring, &ctx->cfgs[n]);
+
+		if (add_network(&ctx->loops[i], &ctx->cfgs[n], ctx->standby)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// run every loop on its own thread until SIGINT.
+static int
+run_threads(struct rp_ctx *ctx)
+{
+	sigset_t mask;
+	unsigned i;
+	int      sig;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+
+	// only the main thread waits for SIGINT
+	if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
+		perror("pthread_sigmask()");
+		return -1;
+	}
+
+	for (i = 0; i < ctx->n_loops; i++) {
+		struct rp_loop *loop = &ctx->loops[i];
+
+		if (pthread_create(&loop->thread, NULL, loop_thread, loop) != 0) {
+			perror("pthread_create()");
+			abort();
+		}
+	}
+
+	while (sigwait(&mask, &sig) != 0 || sig != SIGINT) {
+		// void
+	}
+
+	fprintf(stderr, "SIGINT received, terminating...\n");
+	__atomic_store_n(&rp_stop, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < ctx->n_loops; i++) {
+		rp_event_wake(ctx->loops[i].ev_ctx);
+	}
+
+	for (i = 0; i < ctx->n_loops; i++) {
+		pthread_join(ctx->loops[i].thread, NULL);
+	}
+
+	return 0;
+}
+
 static int
 rp_init(struct rp_ctx *ctx, int argc, const char **argv)
 {
-	const char *config_path;
+	struct rp_options opts;
+	size_t            i;
+
+	memset(ctx, 0, sizeof(*ctx));
 
 	// os initialization should always come first
 	rp_os_init();
+	rp_scan_init();
+	rp_updatetime();
 
-	if (rp_parse_opts(argc, argv, &config_path)) {
+	if (rp_parse_opts(argc, argv, &opts)) {
 		return 1;
 	}
 
@@ -105,35 +658,38 @@ rp_init(struct rp_ctx *ctx, int argc, const char **argv)
 	if (!ctx->pool) {
 		return -1;
 	}
-	memset(&ctx->cfg, 0, sizeof(ctx->cfg));
 
-	if (rp_config_load(ctx->pool, config_path, &ctx->cfg)) {
-		return 1;
-	}
-
-	ctx->read_buf = rp_palloc(ctx->pool, sizeof(*ctx->read_buf) + IRC_BUFFER_SZ);
-	if (!ctx->read_buf) {
+	ctx->n_cfgs = opts.n_configs;
+	ctx->cfgs = rp_pcalloc(ctx->pool, ctx->n_cfgs * sizeof(*ctx->cfgs));
+	if (!ctx->cfgs) {
 		return -1;
 	}
 
-	ctx->write_buf = rp_palloc(ctx->pool, sizeof(*ctx->write_buf) + IRC_BUFFER_SZ);
-	if (!ctx->write_buf) {
-		return -1;
+	for (i = 0; i < ctx->n_cfgs; i++) {
+		if (rp_config_load(ctx->pool, opts.configs[i], &ctx->cfgs[i])) {
+			return 1;
+		}
 	}
 
-	ctx->read_buf->capacity = IRC_BUFFER_SZ;
-	ctx->write_buf->capacity = IRC_BUFFER_SZ;
+	ctx->threaded = opts.threads > 0;
+	ctx->uring = opts.uring;
+	ctx->standby = opts.standby;
+	ctx->write_high = opts.write_high;
+	ctx->nameserver = opts.nameserver;
+	ctx->n_loops = ctx->threaded ? opts.threads : 1;
 
-	rp_fifo_init(ctx->read_buf);
-	rp_fifo_init(ctx->write_buf);
+	if (opts.dns_cache && opts.dns_cache[0]) {
+		ctx->dns_cache = opts.dns_cache;
+	}
 
-	return 0;
+	return rp_loops_init(ctx);
 }
 
 int
 main(int argc, const char **argv)
 {
 	int            ret;
+	unsigned       i;
 	struct rp_ctx  ctx;
 
 	if ((ret = rp_init(&ctx, argc, argv))) {
@@ -144,7 +700,28 @@ main(int argc, const char **argv)
 		exit(0);
 	}
 
-	main_loop(&ctx);
+	if (ctx.threaded) {
+		run_threads(&ctx);
+	} else {
+		main_loop(&ctx.loops[0]);
+	}
+
+	for (i = 0; i < ctx.n_loops; i++) {
+		struct rp_conn *conn;
+
+		// nothing may read into the buffers once they are unmapped
+		rp_event_destroy(ctx.loops[i].ev_ctx);
+
+		LL_FOREACH(rp_event_conns(ctx.loops[i].ev_ctx), conn) {
+			destroy_buf(conn->read_buf);
+			rp_chain_reset(conn->write_buf);
+			rp_irc_destroy(conn->irc);
+		}
+
+		rp_chain_free_release(&ctx.loops[i].chunks);
+
+		rp_destroy_pool(ctx.loops[i].pool);
+	}
 
 	rp_destroy_pool(ctx.pool);
 
@@ -3,8 +3,11 @@
 
 #include <stdint.h>
 
-// current time since last poll
-extern uintptr_t rp_current_msec;
+// current time since last poll, every event loop thread keeps its own.
+extern __thread uintptr_t rp_current_msec;
+
+// update rp_current_msec with the current time.
+void rp_updatetime(void);
 
 #endif // RPBOT_H
 
@@ -11,6 +11,7 @@ dir := $(d)/ircsm
 include $(dir)/rules.mk
 
 OBJS_$(d) := $(d)/rp_config.o \
+             $(d)/rp_dns.o \
              $(d)/rp_event.o \
              $(d)/rp_irc.o \
              $(d)/rp_options.o \
@@ -24,7 +25,7 @@ TGT_BIN := $(TGT_BIN) $(TGTS_$(d))
 
 $(OBJS_$(d)): CF_TGT := -I$(d) -I$(d)/util -I$(d)/ircsm
 
-$(d)/rpbot: LL_TGT := -lyajl -lanl $(d)/util/util.a $(d)/ircsm/ircsm.a
+$(d)/rpbot: LL_TGT := -lyajl -lpthread $(d)/util/util.a $(d)/ircsm/ircsm.a
 $(d)/rpbot: $(OBJS_$(d)) $(d)/util/util.a $(d)/ircsm/ircsm.a
 	$(LINK)
 
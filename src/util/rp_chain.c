@@ -0,0 +1,222 @@
+#include <string.h>
+#include <stdlib.h>
+#include <rp_os.h>
+#include <rp_math.h>
+#include <rp_chain.h>
+
+void
+rp_chain_free_init(rp_chain_free_t *freelist, size_t max)
+{
+	freelist->chunks = NULL;
+	freelist->n_chunks = 0;
+	freelist->max = max;
+}
+
+void
+rp_chain_free_release(rp_chain_free_t *freelist)
+{
+	rp_chain_chunk_t *c;
+
+	while ((c = freelist->chunks) != NULL) {
+		freelist->chunks = c->next;
+		rp_free(c);
+	}
+
+	freelist->n_chunks = 0;
+}
+
+// a chunk from the free list, or a new page if the list is empty.
+static rp_chain_chunk_t *
+chunk_alloc(rp_chain_free_t *freelist)
+{
+	rp_chain_chunk_t *c = freelist->chunks;
+
+	if (c != NULL) {
+		freelist->chunks = c->next;
+		freelist->n_chunks--;
+	} else if ((c = rp_memalign(rp_pagesize, rp_pagesize)) == NULL) {
+		return NULL;
+	}
+
+	c->next = NULL;
+	c->pos = c->data;
+	c->last = c->data;
+	c->end = (u_char *)c + rp_pagesize;
+
+	return c;
+}
+
+static void
+chunk_free(rp_chain_free_t *freelist, rp_chain_chunk_t *c)
+{
+	if (freelist->n_chunks >= freelist->max) {
+		rp_free(c);
+		return;
+	}
+
+	c->next = freelist->chunks;
+	freelist->chunks = c;
+	freelist->n_chunks++;
+}
+
+void
+rp_chain_init(rp_chain_t *chain, rp_chain_free_t *freelist, size_t high)
+{
+	chain->freelist = freelist;
+	chain->head = NULL;
+	chain->tail = NULL;
+	chain->count = 0;
+	chain->high = high;
+}
+
+int
+rp_chain_put(rp_chain_t *chain, const void *src, size_t n)
+{
+	const u_char *p = src;
+	rp_chain_chunk_t *first = NULL, *last = NULL, *c;
+	size_t room = chain->tail ? (size_t)(chain->tail->end - chain->tail->last) : 0;
+
+	// take all the chunks it needs up front, so a failure leaves the
+	// chain as it was instead of holding half a line.
+	while (room < n) {
+		if ((c = chunk_alloc(chain->freelist)) == NULL) {
+			while ((c = first) != NULL) {
+				first = c->next;
+				chunk_free(chain->freelist, c);
+			}
+
+			return -1;
+		}
+
+		if (last) {
+			last->next = c;
+		} else {
+			first = c;
+		}
+
+		last = c;
+		room += (size_t)(c->end - c->data);
+	}
+
+	if (first) {
+		if (chain->tail) {
+			chain->tail->next = first;
+		} else {
+			chain->head = first;
+		}
+	}
+
+	c = chain->tail ? chain->tail : first;
+	chain->count += n;
+
+	while (n > 0) {
+		size_t s = rp_min(n, (size_t)(c->end - c->last));
+
+		memcpy(c->last, p, s);
+		c->last += s;
+		p += s;
+		n -= s;
+
+		if (c->last == c->end && c->next) {
+			c = c->next;
+		}
+	}
+
+	if (last) {
+		chain->tail = last;
+	}
+
+	return 0;
+}
+
+u_char *
+rp_chain_reserve(rp_chain_t *chain, size_t n)
+{
+	rp_chain_chunk_t *c = chain->tail;
+
+	if (c && (size_t)(c->end - c->last) >= n) {
+		return c->last;
+	}
+
+	// what is left of the tail is skipped
+	if ((c = chunk_alloc(chain->freelist)) == NULL) {
+		return NULL;
+	}
+
+	if ((size_t)(c->end - c->data) < n) {
+		chunk_free(chain->freelist, c);
+		return NULL;
+	}
+
+	if (chain->tail) {
+		chain->tail->next = c;
+	} else {
+		chain->head = c;
+	}
+
+	chain->tail = c;
+
+	return c->last;
+}
+
+int
+rp_chain_iov(rp_chain_t *chain, struct iovec *iov, int max)
+{
+	rp_chain_chunk_t *c;
+	int n = 0;
+
+	for (c = chain->head; c != NULL && n < max; c = c->next) {
+		if (c->last == c->pos) {
+			continue;
+		}
+
+		iov[n].iov_base = c->pos;
+		iov[n].iov_len = (size_t)(c->last - c->pos);
+		n++;
+	}
+
+	return n;
+}
+
+void
+rp_chain_consume(rp_chain_t *chain, size_t n)
+{
+	rp_chain_chunk_t *c;
+
+	chain->count -= n;
+
+	while ((c = chain->head) != NULL) {
+		size_t s = rp_min(n, (size_t)(c->last - c->pos));
+
+		c->pos += s;
+		n -= s;
+
+		if (c->pos < c->last) {
+			break;
+		}
+
+		// only the tail has room left, so a drained chunk is done
+		// with. an idle chain holds no memory at all.
+		chain->head = c->next;
+
+		if (c == chain->tail) {
+			chain->tail = NULL;
+		}
+
+		chunk_free(chain->freelist, c);
+	}
+}
+
+void
+rp_chain_reset(rp_chain_t *chain)
+{
+	rp_chain_chunk_t *c;
+
+	while ((c = chain->head) != NULL) {
+		chain->head = c->next;
+		chunk_free(chain->freelist, c);
+	}
+
+	chain->tail = NULL;
+	chain->count = 0;
+}
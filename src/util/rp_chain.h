@@ -0,0 +1,94 @@
+#ifndef RP_CHAIN_H
+#define RP_CHAIN_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <rp_string.h>
+
+// a buffer made of page sized chunks. it grows by a chunk at a time as
+// data is put in and hands chunks back to its free list as soon as they
+// are drained, so a burst costs memory only while it lasts.
+
+typedef struct rp_chain_chunk rp_chain_chunk_t;
+
+struct rp_chain_chunk {
+	rp_chain_chunk_t *next;
+	u_char           *pos; // the first byte that was not consumed yet
+	u_char           *last; // the end of the data
+	u_char           *end;
+	u_char            data[];
+};
+
+// chunks that are not in use, shared by the chains of one thread. up to
+// max chunks are kept, the rest go back to the system.
+typedef struct {
+	rp_chain_chunk_t *chunks;
+	size_t            n_chunks;
+	size_t            max;
+} rp_chain_free_t;
+
+typedef struct {
+	rp_chain_free_t  *freelist;
+	rp_chain_chunk_t *head;
+	rp_chain_chunk_t *tail;
+	size_t            count; // number of bytes in the chain
+	size_t            high; // high watermark
+} rp_chain_t;
+
+void rp_chain_free_init(rp_chain_free_t *freelist, size_t max);
+
+// give the chunks of the free list back to the system.
+void rp_chain_free_release(rp_chain_free_t *freelist);
+
+// initialize an empty chain. high is where rp_chain_full starts to
+// report it as full, data can still be put into it beyond that.
+void rp_chain_init(rp_chain_t *chain, rp_chain_free_t *freelist,
+	size_t high);
+
+// number of bytes in the chain
+#define rp_chain_count(_chain) ((_chain)->count)
+
+// whether the producers of the chain should hold back until it drained
+#define rp_chain_full(_chain) ((_chain)->count >= (_chain)->high)
+
+// append n bytes from src. the chain grows as needed, returns -1 and
+// puts nothing if no memory is left for it.
+int rp_chain_put(rp_chain_t *chain, const void *src, size_t n);
+
+// a pointer to n contiguous bytes at the end of the chain, for data that
+// is formatted in place. n must fit into a chunk, the bytes are added
+// with rp_chain_commit. returns NULL if no memory is left.
+u_char * rp_chain_reserve(rp_chain_t *chain, size_t n);
+
+// add n bytes of the space of rp_chain_reserve to the chain.
+static inline void
+rp_chain_commit(rp_chain_t *chain, size_t n)
+{
+	chain->tail->last += n;
+	chain->count += n;
+}
+
+// fill at most max iovecs with the data at the front of the chain, for
+// a writev. returns the number of iovecs used.
+int rp_chain_iov(rp_chain_t *chain, struct iovec *iov, int max);
+
+// drop n bytes from the front, drained chunks go to the free list.
+void rp_chain_consume(rp_chain_t *chain, size_t n);
+
+// drop everything in the chain.
+void rp_chain_reset(rp_chain_t *chain);
+
+static inline int
+rp_chain_putstr(rp_chain_t *chain, const char *str)
+{
+	return rp_chain_put(chain, str, strlen(str));
+}
+
+static inline int
+rp_chain_putstring(rp_chain_t *chain, rp_str_t *str)
+{
+	return rp_chain_put(chain, str->ptr, str->len);
+}
+
+#endif // RP_CHAIN_H
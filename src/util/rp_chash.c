@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <rp_chash.h>
+
+// 32 bit fnv-1a, followed by the murmur3 finalizer. fnv alone leaves
+// short keys clustered on the ring.
+uint32_t
+rp_chash_key(const u_char *key, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= key[i];
+		h *= 16777619u;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static int
+point_cmp(const void *a, const void *b)
+{
+	const struct rp_chash_point *pa = a;
+	const struct rp_chash_point *pb = b;
+
+	if (pa->hash != pb->hash) {
+		return pa->hash < pb->hash ? -1 : 1;
+	}
+
+	// equal hashes are rare, but must sort the same on every run
+	return (int)pa->node - (int)pb->node;
+}
+
+int
+rp_chash_init(rp_pool_t *pool, rp_chash_t *ring, unsigned n_nodes)
+{
+	unsigned node, v;
+	size_t i = 0;
+
+	ring->n_points = (size_t)n_nodes * RP_CHASH_VNODES;
+	ring->points = rp_palloc(pool, ring->n_points * sizeof(*ring->points));
+
+	if (!ring->points) {
+		return -1;
+	}
+
+	for (node = 0; node < n_nodes; node++) {
+		for (v = 0; v < RP_CHASH_VNODES; v++) {
+			uint32_t id[2] = { node, v };
+
+			ring->points[i].hash = rp_chash_key((u_char *)id, sizeof(id));
+			ring->points[i].node = node;
+			i++;
+		}
+	}
+
+	qsort(ring->points, ring->n_points, sizeof(*ring->points), point_cmp);
+
+	return 0;
+}
+
+unsigned
+rp_chash_lookup(rp_chash_t *ring, const u_char *key, size_t len)
+{
+	uint32_t h = rp_chash_key(key, len);
+	size_t lo = 0, hi = ring->n_points;
+
+	// first point at or after h, wrapping around to the start
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (ring->points[mid].hash < h) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo == ring->n_points) {
+		lo = 0;
+	}
+
+	return ring->points[lo].node;
+}
@@ -0,0 +1,29 @@
+#ifndef RP_CHASH_H
+#define RP_CHASH_H
+
+#include <stdint.h>
+#include <rp_palloc.h>
+
+// a consistent hash ring mapping keys to nodes, every node is placed on
+// the ring several times to even out the distribution.
+struct rp_chash_point {
+	uint32_t hash;
+	unsigned node;
+};
+
+typedef struct {
+	struct rp_chash_point *points;
+	size_t                 n_points;
+} rp_chash_t;
+
+#define RP_CHASH_VNODES 160
+
+uint32_t rp_chash_key(const u_char *key, size_t len);
+
+// build a ring with nodes 0..n_nodes-1.
+int rp_chash_init(rp_pool_t *pool, rp_chash_t *ring, unsigned n_nodes);
+
+// the node that owns key.
+unsigned rp_chash_lookup(rp_chash_t *ring, const u_char *key, size_t len);
+
+#endif // RP_CHASH_H
@@ -1,14 +1,85 @@
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <rp_os.h>
 #include <rp_fifo.h>
 
 void
 rp_fifo_init(rp_fifo_t *buf)
 {
-	buf->count = 0;
-	buf->head = &buf->buffer[0];
-	buf->tail = &buf->buffer[0];
 	buf->end = &buf->buffer[0] + buf->capacity;
+	buf->limit = buf->end;
+	rp_fifo_reset(buf);
+}
+
+// the struct sits at the end of a page of its own, so the buffer starts
+// at the first of the mirrored pages.
+rp_fifo_t *
+rp_fifo_create_mirrored(size_t capacity)
+{
+	size_t hdr = rp_align(offsetof(rp_fifo_t, buffer), rp_pagesize);
+	u_char *base, *data;
+	int fd;
+
+	capacity = rp_align(capacity, rp_pagesize);
+
+	if (capacity == 0) {
+		return NULL;
+	}
+
+	// reserve the address space for both mappings in one go
+	base = mmap(NULL, hdr + 2 * capacity, PROT_NONE,
+	            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+
+	data = base + hdr;
+
+	if (mmap(base, hdr, PROT_READ | PROT_WRITE,
+	         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+		goto failed;
+	}
+
+	if ((fd = memfd_create("rp_fifo", MFD_CLOEXEC)) == -1) {
+		goto failed;
+	}
+
+	if (ftruncate(fd, (off_t)capacity) == -1 ||
+	    mmap(data, capacity, PROT_READ | PROT_WRITE,
+	         MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+	    mmap(data + capacity, capacity, PROT_READ | PROT_WRITE,
+	         MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		close(fd);
+		goto failed;
+	}
+
+	// the mappings keep the memory
+	close(fd);
+
+	rp_fifo_t *buf = (rp_fifo_t *)(data - offsetof(rp_fifo_t, buffer));
+
+	buf->capacity = capacity;
+	rp_fifo_init(buf);
+	buf->limit = buf->end + capacity;
+
+	return buf;
+
+failed:
+	munmap(base, hdr + 2 * capacity);
+
+	return NULL;
+}
+
+void
+rp_fifo_destroy_mirrored(rp_fifo_t *buf)
+{
+	size_t hdr = rp_align(offsetof(rp_fifo_t, buffer), rp_pagesize);
+
+	munmap(&buf->buffer[0] - hdr, hdr + 2 * buf->capacity);
 }
 
 size_t
@@ -23,7 +94,7 @@ rp_fifo_put(rp_fifo_t *buf, void *src, size_t n)
 	size_t ret = n;
 
 	while (n > 0) {
-		size_t s = rp_min(n, (size_t)(buf->end - buf->tail));
+		size_t s = rp_min(n, (size_t)(buf->limit - buf->tail));
 		memcpy(buf->tail, p, s);
 
 		p += s;
@@ -47,7 +118,7 @@ rp_fifo_get(rp_fifo_t *buf, void *dest, size_t n)
 	size_t ret = n;
 
 	while (n > 0) {
-		size_t s = rp_min(n, (size_t)(buf->end - buf->head));
+		size_t s = rp_min(n, (size_t)(buf->limit - buf->head));
 		memcpy(p, buf->head, s);
 
 		p += s;
@@ -59,3 +130,23 @@ rp_fifo_get(rp_fifo_t *buf, void *dest, size_t n)
 	return ret;
 }
 
+
+size_t
+rp_fifo_peek(rp_fifo_t *buf, void *dest, size_t n)
+{
+	char *p = dest;
+	u_char *head = buf->head;
+
+	if ((n = rp_min(n, buf->count)) == 0) {
+		return 0;
+	}
+
+	size_t s = rp_min(n, (size_t)(buf->limit - head));
+	memcpy(p, head, s);
+
+	if (s < n) {
+		memcpy(p + s, &buf->buffer[0], n - s);
+	}
+
+	return n;
+}
@@ -3,23 +3,46 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <rp_math.h>
 #include <rp_string.h>
 
+// a ring buffer. a mirrored buffer has its pages mapped a second time
+// right after the first, so the data and the free space are contiguous
+// no matter where they wrap, and raw reads and writes are never split.
 struct rp_fifo {
 	size_t    capacity;
 	size_t    count; // number of bytes in the buffer
 	u_char   *head;
 	u_char   *tail;
-	u_char   *end;
+	u_char   *end; // where head and tail wrap around
+	u_char   *limit; // end of the contiguous memory, past end if mirrored
 	u_char    buffer[];
 };
 
 typedef struct rp_fifo  rp_fifo_t;
 
-// initialize a buffer
+// initialize a buffer of capacity bytes that follow the struct
 void rp_fifo_init(rp_fifo_t *buf);
 
+// create a mirrored buffer, capacity is rounded up to whole pages.
+// returns NULL if the memory could not be mapped.
+rp_fifo_t * rp_fifo_create_mirrored(size_t capacity);
+
+// unmap a buffer of rp_fifo_create_mirrored.
+void rp_fifo_destroy_mirrored(rp_fifo_t *buf);
+
+#define rp_fifo_mirrored(_buf) ((_buf)->limit != (_buf)->end)
+
+// empty a buffer of either kind
+static inline void
+rp_fifo_reset(rp_fifo_t *buf)
+{
+	buf->count = 0;
+	buf->head = &buf->buffer[0];
+	buf->tail = &buf->buffer[0];
+}
+
 // number of bytes free in the buffer
 #define rp_fifo_bytes_free(_buf) ((_buf)->capacity - (_buf)->count)
 
@@ -27,15 +50,16 @@ void rp_fifo_init(rp_fifo_t *buf);
 #define rp_fifo_count(_buf) ((_buf)->count)
 
 // consume n bytes, used in conjunction with fifo_raw_r for direct
-// writing to socket buffers
+// writing to socket buffers. n may reach past the end of the buffer
+// when the data was read with fifo_peek.
 static inline void
 rp_fifo_consume(rp_fifo_t *buf, size_t n)
 {
 	buf->head += n;
 	buf->count -= n;
 
-	if (buf->head == buf->end) {
-		buf->head = &buf->buffer[0];
+	if (buf->head >= buf->end) {
+		buf->head -= buf->capacity;
 	}
 }
 
@@ -47,8 +71,8 @@ rp_fifo_reserve(rp_fifo_t *buf, size_t n)
 	buf->tail += n;
 	buf->count += n;
 
-	if (buf->tail == buf->end) {
-		buf->tail = &buf->buffer[0];
+	if (buf->tail >= buf->end) {
+		buf->tail -= buf->capacity;
 	}
 }
 
@@ -59,7 +83,7 @@ static inline size_t
 rp_fifo_raw_r(rp_fifo_t *buf, void **p)
 {
 	*p = buf->head;
-	return rp_min(rp_fifo_count(buf), (size_t)(buf->end - buf->head));
+	return rp_min(rp_fifo_count(buf), (size_t)(buf->limit - buf->head));
 }
 
 // get a pointer to the internal buffer, returns the number of bytes
@@ -69,7 +93,29 @@ static inline size_t
 rp_fifo_raw_w(rp_fifo_t *buf, void **p)
 {
 	*p = buf->tail;
-	return rp_min(rp_fifo_bytes_free(buf), (size_t)(buf->end - buf->tail));
+	return rp_min(rp_fifo_bytes_free(buf), (size_t)(buf->limit - buf->tail));
+}
+
+// fill iov with the free space of the buffer for a readv, it takes two
+// iovecs when the space wraps. use fifo_reserve afterwards to indicate
+// the number of bytes written. returns the number of iovecs.
+static inline int
+rp_fifo_iov_w(rp_fifo_t *buf, struct iovec *iov)
+{
+	size_t room = rp_fifo_bytes_free(buf);
+	size_t n = rp_min(room, (size_t)(buf->limit - buf->tail));
+
+	iov[0].iov_base = buf->tail;
+	iov[0].iov_len = n;
+
+	if (n == room) {
+		return 1;
+	}
+
+	iov[1].iov_base = &buf->buffer[0];
+	iov[1].iov_len = room - n;
+
+	return 2;
 }
 
 // put n bytes from src into the buffer. returns number of bytes
@@ -80,6 +126,10 @@ size_t rp_fifo_put(rp_fifo_t *buf, void *src, size_t n);
 // placed in dest.
 size_t rp_fifo_get(rp_fifo_t *buf, void *dest, size_t n);
 
+// copy at most n bytes from the buffer without consuming them. returns
+// number of bytes placed in dest.
+size_t rp_fifo_peek(rp_fifo_t *buf, void *dest, size_t n);
+
 static inline size_t
 rp_fifo_putstr(rp_fifo_t *buf, const char *str)
 {
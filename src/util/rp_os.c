@@ -3,16 +3,21 @@
 
 uintptr_t rp_pagesize;
 uintptr_t rp_pagesize_shift;
+uintptr_t rp_ncpu;
 
 int
 rp_os_init(void)
 {
 	uintptr_t n;
+	long ncpu;
 
 	rp_pagesize = getpagesize();
 
 	for (n = rp_pagesize; n >>= 1; rp_pagesize_shift++) { /* void */ }
 
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	rp_ncpu = ncpu > 0 ? (uintptr_t)ncpu : 1;
+
 	return 0;
 }
 
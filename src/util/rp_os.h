@@ -7,6 +7,7 @@
 
 extern uintptr_t rp_pagesize;
 extern uintptr_t rp_pagesize_shift;
+extern uintptr_t rp_ncpu;
 
 int rp_os_init(void);
 
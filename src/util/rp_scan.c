@@ -0,0 +1,121 @@
+#include <string.h>
+#include <rp_scan.h>
+
+#if (RP_SCAN_HAVE_SIMD)
+#include <immintrin.h>
+#endif
+
+rp_scan_crlf_t rp_scan_crlf = rp_scan_crlf_scalar;
+
+// every '\n' found by the scanners is checked against the byte before it,
+// which is only looked at when it is still inside the buffer.
+#define is_crlf(_start, _nl) ((_nl) > (_start) && (_nl)[-1] == '\r')
+
+const char *
+rp_scan_crlf_scalar(const char *p, size_t len)
+{
+	const char *start = p;
+	const char *end = p + len;
+	const char *nl;
+
+	while ((nl = memchr(p, '\n', end - p)) != NULL) {
+		if (is_crlf(start, nl)) {
+			return nl - 1;
+		}
+
+		p = nl + 1;
+	}
+
+	return NULL;
+}
+
+#if (RP_SCAN_HAVE_SIMD)
+
+__attribute__((target("sse2")))
+const char *
+rp_scan_crlf_sse2(const char *p, size_t len)
+{
+	const char *start = p;
+	const char *end = p + len;
+	const __m128i nl = _mm_set1_epi8('\n');
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+
+		while (mask) {
+			const char *c = p + __builtin_ctz(mask);
+
+			if (is_crlf(start, c)) {
+				return c - 1;
+			}
+
+			mask &= mask - 1;
+		}
+
+		p += 16;
+	}
+
+	// the tail may start right after a '\r' of the vector part
+	if (p < end && *p == '\n' && is_crlf(start, p)) {
+		return p - 1;
+	}
+
+	return rp_scan_crlf_scalar(p, end - p);
+}
+
+__attribute__((target("avx2")))
+const char *
+rp_scan_crlf_avx2(const char *p, size_t len)
+{
+	const char *start = p;
+	const char *end = p + len;
+	const __m256i nl = _mm256_set1_epi8('\n');
+
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+
+		while (mask) {
+			const char *c = p + __builtin_ctz(mask);
+
+			if (is_crlf(start, c)) {
+				return c - 1;
+			}
+
+			mask &= mask - 1;
+		}
+
+		p += 32;
+	}
+
+	if (p < end && *p == '\n' && is_crlf(start, p)) {
+		return p - 1;
+	}
+
+	return rp_scan_crlf_sse2(p, end - p);
+}
+
+int
+rp_scan_have_avx2(void)
+{
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif // (RP_SCAN_HAVE_SIMD)
+
+void
+rp_scan_init(void)
+{
+#if (RP_SCAN_HAVE_SIMD)
+	if (rp_scan_have_avx2()) {
+		rp_scan_crlf = rp_scan_crlf_avx2;
+	} else {
+		rp_scan_crlf = rp_scan_crlf_sse2;
+	}
+#else
+	rp_scan_crlf = rp_scan_crlf_scalar;
+#endif
+}
@@ -0,0 +1,29 @@
+#ifndef RP_SCAN_H
+#define RP_SCAN_H
+
+#include <stdlib.h>
+
+// find the first "\r\n" in the len bytes at p. returns a pointer to the
+// '\r', or NULL if there is none. a bare '\n' is not a line end.
+typedef const char *(* rp_scan_crlf_t)(const char *p, size_t len);
+
+// the best implementation for this cpu once rp_scan_init ran, the
+// scalar one until then.
+extern rp_scan_crlf_t rp_scan_crlf;
+
+// pick the implementation for this cpu. called once at startup before
+// any threads are started, rp_scan_crlf is not changed after that.
+void rp_scan_init(void);
+
+const char * rp_scan_crlf_scalar(const char *p, size_t len);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RP_SCAN_HAVE_SIMD 1
+
+const char * rp_scan_crlf_sse2(const char *p, size_t len);
+const char * rp_scan_crlf_avx2(const char *p, size_t len);
+
+int rp_scan_have_avx2(void);
+#endif
+
+#endif // RP_SCAN_H
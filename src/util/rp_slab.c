@@ -41,9 +41,11 @@ static struct rp_slab_page * rp_slab_alloc_pages(rp_slab_pool_t *pool,
 static void rp_slab_free_pages(rp_slab_pool_t *pool,
 	struct rp_slab_page *page, uintptr_t pages);
 
-static uint64_t rp_slab_max_size = 0;
-static uint64_t rp_slab_exact_size;
-static uint64_t rp_slab_exact_shift;
+// sizing derived from the page size, every event loop thread computes its
+// own copy the first time it sets up a slab pool.
+static __thread uint64_t rp_slab_max_size = 0;
+static __thread uint64_t rp_slab_exact_size;
+static __thread uint64_t rp_slab_exact_shift;
 
 void
 rp_slab_init(rp_slab_pool_t *pool)
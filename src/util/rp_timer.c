@@ -0,0 +1,188 @@
+#include <string.h>
+#include <utlist.h>
+#include <rp_timer.h>
+
+#define RP_TIMER_MASK   (RP_TIMER_SLOTS - 1)
+#define RP_TIMER_SPAN   (RP_TIMER_BITS * RP_TIMER_LEVELS)
+
+#define level_shift(l)  ((l) * RP_TIMER_BITS)
+#define level_index(t, l) (((t) >> level_shift(l)) & RP_TIMER_MASK)
+
+void
+rp_timer_wheel_init(rp_timer_wheel_t *wheel, uintptr_t now)
+{
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->now = now;
+}
+
+// put a timer on the level of the highest group of bits it differs from
+// now in. expires is never before now.
+static void
+timer_place(rp_timer_wheel_t *wheel, rp_timer_t *timer)
+{
+	uint64_t diff = (uint64_t)(timer->expires ^ wheel->now);
+	unsigned level = 0;
+
+	if (diff >> RP_TIMER_SPAN) {
+		timer->level = RP_TIMER_LEVELS;
+		DL_APPEND(wheel->overflow, timer);
+		return;
+	}
+
+	if (diff) {
+		level = (63 - __builtin_clzll(diff)) / RP_TIMER_BITS;
+	}
+
+	timer->level = level;
+	timer->slot = level_index(timer->expires, level);
+
+	DL_APPEND(wheel->slots[level][timer->slot], timer);
+	wheel->occupied[level] |= (uint64_t)1 << timer->slot;
+}
+
+void
+rp_timer_add(rp_timer_wheel_t *wheel, rp_timer_t *timer, uintptr_t expires)
+{
+	if (timer->active) {
+		rp_timer_del(wheel, timer);
+	}
+
+	// the slot of the current tick has already run
+	if (expires <= wheel->now) {
+		expires = wheel->now + 1;
+	}
+
+	timer->expires = expires;
+	timer->active = 1;
+	wheel->count++;
+
+	timer_place(wheel, timer);
+}
+
+void
+rp_timer_del(rp_timer_wheel_t *wheel, rp_timer_t *timer)
+{
+	if (!timer->active) {
+		return;
+	}
+
+	if (timer->level == RP_TIMER_LEVELS) {
+		DL_DELETE(wheel->overflow, timer);
+	} else {
+		rp_timer_t **head = &wheel->slots[timer->level][timer->slot];
+
+		DL_DELETE(*head, timer);
+
+		if (*head == NULL) {
+			wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+		}
+	}
+
+	timer->active = 0;
+	wheel->count--;
+}
+
+uintptr_t
+rp_timer_next(rp_timer_wheel_t *wheel)
+{
+	uintptr_t next = RP_TIMER_INFINITE;
+	unsigned l;
+
+	if (wheel->count == 0) {
+		return next;
+	}
+
+	// every occupied slot lies after the current index of its level, so
+	// the first one per level is the earliest time it needs attention.
+	for (l = 0; l < RP_TIMER_LEVELS; l++) {
+		unsigned idx = level_index(wheel->now, l);
+		uint64_t occ;
+
+		if (idx == RP_TIMER_MASK) {
+			continue;
+		}
+
+		occ = wheel->occupied[l] & (~(uint64_t)0 << (idx + 1));
+
+		if (occ) {
+			uintptr_t base = wheel->now >> level_shift(l + 1)
+			                 << level_shift(l + 1);
+			uintptr_t t = base
+			              + ((uintptr_t)__builtin_ctzll(occ) << level_shift(l));
+
+			if (t < next) {
+				next = t;
+			}
+		}
+	}
+
+	if (wheel->overflow) {
+		uintptr_t t = ((wheel->now >> RP_TIMER_SPAN) + 1) << RP_TIMER_SPAN;
+
+		if (t < next) {
+			next = t;
+		}
+	}
+
+	return next;
+}
+
+// move the timers of the slots that start at the current time one or
+// more levels down.
+static void
+timer_cascade(rp_timer_wheel_t *wheel)
+{
+	rp_timer_t *list, *timer;
+	unsigned l;
+
+	for (l = 1; l <= RP_TIMER_LEVELS; l++) {
+		if (wheel->now & (((uintptr_t)1 << level_shift(l)) - 1)) {
+			break;
+		}
+
+		if (l == RP_TIMER_LEVELS) {
+			list = wheel->overflow;
+			wheel->overflow = NULL;
+		} else {
+			unsigned idx = level_index(wheel->now, l);
+
+			list = wheel->slots[l][idx];
+			wheel->slots[l][idx] = NULL;
+			wheel->occupied[l] &= ~((uint64_t)1 << idx);
+		}
+
+		while ((timer = list) != NULL) {
+			DL_DELETE(list, timer);
+			timer_place(wheel, timer);
+		}
+	}
+}
+
+void
+rp_timer_expire(rp_timer_wheel_t *wheel, uintptr_t now)
+{
+	while (1) {
+		uintptr_t next = rp_timer_next(wheel);
+
+		if (next > now) {
+			if (now > wheel->now) {
+				wheel->now = now;
+			}
+
+			return;
+		}
+
+		wheel->now = next;
+		timer_cascade(wheel);
+
+		// handlers may add and cancel timers, new ones never land in
+		// the slot that is running.
+		unsigned idx = level_index(next, 0);
+		rp_timer_t *timer;
+
+		while ((timer = wheel->slots[0][idx]) != NULL) {
+			rp_timer_del(wheel, timer);
+			timer->handler(timer);
+		}
+	}
+}
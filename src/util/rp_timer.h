@@ -0,0 +1,67 @@
+#ifndef RP_TIMER_H
+#define RP_TIMER_H
+
+#include <stdint.h>
+
+// a hierarchical timing wheel with millisecond ticks. level l has 64
+// slots of 64^l ms each, a timer sits on the lowest level whose slot
+// still tells it apart from the current time and moves down a level
+// when the wheel reaches its slot. adding and cancelling are O(1),
+// timers further out than the top level wait on an overflow list.
+#define RP_TIMER_BITS   6
+#define RP_TIMER_SLOTS  (1 << RP_TIMER_BITS)
+#define RP_TIMER_LEVELS 5
+
+#define RP_TIMER_INFINITE UINTPTR_MAX
+
+typedef struct rp_timer rp_timer_t;
+
+typedef void (*rp_timer_handler_t)(rp_timer_t *timer);
+
+struct rp_timer {
+	uintptr_t           expires; // msec
+	rp_timer_handler_t  handler;
+	void               *data;
+
+	struct rp_timer    *prev;
+	struct rp_timer    *next;
+
+	unsigned char       level;
+	unsigned char       slot;
+	unsigned int        active:1;
+};
+
+typedef struct {
+	uintptr_t   now; // time the wheel has advanced to
+	rp_timer_t *slots[RP_TIMER_LEVELS][RP_TIMER_SLOTS];
+	uint64_t    occupied[RP_TIMER_LEVELS]; // bitmap of non empty slots
+	rp_timer_t *overflow;
+	size_t      count;
+} rp_timer_wheel_t;
+
+void rp_timer_wheel_init(rp_timer_wheel_t *wheel, uintptr_t now);
+
+// arm a timer to fire at expires, a timer that is already armed is moved.
+// timers due now or in the past fire on the next tick.
+void rp_timer_add(rp_timer_wheel_t *wheel, rp_timer_t *timer,
+	uintptr_t expires);
+
+void rp_timer_del(rp_timer_wheel_t *wheel, rp_timer_t *timer);
+
+// the earliest time the wheel has work to do, never later than the
+// nearest deadline. RP_TIMER_INFINITE when no timer is armed.
+uintptr_t rp_timer_next(rp_timer_wheel_t *wheel);
+
+// advance the wheel to now and run the handlers of every expired timer.
+void rp_timer_expire(rp_timer_wheel_t *wheel, uintptr_t now);
+
+#define rp_timer_init(t, h, d) \
+	do { \
+		(t)->handler = (h); \
+		(t)->data = (d); \
+		(t)->active = 0; \
+	} while (0)
+
+#define rp_timer_active(t) ((t)->active)
+
+#endif // RP_TIMER_H
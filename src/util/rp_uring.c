@@ -0,0 +1,184 @@
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <rp_uring.h>
+
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+	unsigned flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+	                    flags, arg, argsz);
+}
+
+int
+rp_uring_init(rp_uring_t *ring, unsigned entries)
+{
+	struct io_uring_params p;
+	u_char *sq, *cq;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+
+	ring->fd = sys_io_uring_setup(entries, &p);
+
+	if (ring->fd < 0) {
+		return -1;
+	}
+
+	// waiting with a timeout needs EXT_ARG, and the rings are mapped
+	// in one go.
+	if (!(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_NODROP)) {
+		close(ring->fd);
+		return -1;
+	}
+
+	ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (ring->cq_ring_sz > ring->sq_ring_sz) {
+		ring->sq_ring_sz = ring->cq_ring_sz;
+	}
+
+	ring->cq_ring_sz = ring->sq_ring_sz;
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE,
+	                     MAP_SHARED | MAP_POPULATE, ring->fd,
+	                     IORING_OFF_SQ_RING);
+
+	if (ring->sq_ring == MAP_FAILED) {
+		close(ring->fd);
+		return -1;
+	}
+
+	ring->cq_ring = ring->sq_ring;
+
+	ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+	if (ring->sqes == MAP_FAILED) {
+		munmap(ring->sq_ring, ring->sq_ring_sz);
+		close(ring->fd);
+		return -1;
+	}
+
+	sq = ring->sq_ring;
+	cq = ring->cq_ring;
+
+	ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring->sq_entries = p.sq_entries;
+	ring->sq_pending = *ring->sq_tail;
+
+	ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+}
+
+void
+rp_uring_exit(rp_uring_t *ring)
+{
+	munmap(ring->sqes, ring->sqes_sz);
+	munmap(ring->sq_ring, ring->sq_ring_sz);
+	close(ring->fd);
+}
+
+struct io_uring_sqe *
+rp_uring_get_sqe(rp_uring_t *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	if (ring->sq_pending - head >= ring->sq_entries) {
+		if (rp_uring_enter(ring, 0, 0) == -1) {
+			return NULL;
+		}
+
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+		if (ring->sq_pending - head >= ring->sq_entries) {
+			return NULL;
+		}
+	}
+
+	unsigned idx = ring->sq_pending & *ring->sq_mask;
+
+	ring->sq_array[idx] = idx;
+	ring->sq_pending++;
+
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+int
+rp_uring_enter(rp_uring_t *ring, unsigned wait_nr, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned to_submit, flags = 0;
+	void *argp = NULL;
+	size_t argsz = 0;
+	int ret;
+
+	to_submit = ring->sq_pending - *ring->sq_tail;
+	__atomic_store_n(ring->sq_tail, ring->sq_pending, __ATOMIC_RELEASE);
+
+	if (timeout == 0) {
+		wait_nr = 0;
+	}
+
+	if (wait_nr > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+
+		if (timeout > 0) {
+			memset(&arg, 0, sizeof(arg));
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+
+			arg.ts = (unsigned long)&ts;
+			flags |= IORING_ENTER_EXT_ARG;
+			argp = &arg;
+			argsz = sizeof(arg);
+		}
+	}
+
+	if (to_submit == 0 && wait_nr == 0) {
+		return 0;
+	}
+
+	ring->syscalls++;
+	ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags, argp, argsz);
+
+	if (ret < 0) {
+		switch (errno) {
+		case ETIME: // timed out
+		case EINTR:
+		case EBUSY: // completions have to be reaped first
+			return 0;
+		default:
+			return -1;
+		}
+	}
+
+	return ret;
+}
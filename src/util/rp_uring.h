@@ -0,0 +1,68 @@
+#ifndef RP_URING_H
+#define RP_URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+// a minimal io_uring on top of the raw syscalls, enough for the event
+// loop to queue socket i/o and wait for it together with epoll.
+typedef struct {
+	int                  fd;
+
+	// submission queue
+	unsigned            *sq_head;
+	unsigned            *sq_tail;
+	unsigned            *sq_mask;
+	unsigned            *sq_array;
+	unsigned             sq_entries;
+	unsigned             sq_pending; // tail of the queued, unsubmitted sqes
+	struct io_uring_sqe *sqes;
+
+	// completion queue
+	unsigned            *cq_head;
+	unsigned            *cq_tail;
+	unsigned            *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void                *sq_ring;
+	void                *cq_ring;
+	size_t               sq_ring_sz;
+	size_t               cq_ring_sz;
+	size_t               sqes_sz;
+
+	unsigned long        syscalls; // io_uring_enter calls
+} rp_uring_t;
+
+// set up a ring, returns -1 if the kernel lacks io_uring or a feature
+// the event loop relies on.
+int rp_uring_init(rp_uring_t *ring, unsigned entries);
+
+void rp_uring_exit(rp_uring_t *ring);
+
+// a zeroed sqe to fill in, submits the queued ones if the queue is full.
+struct io_uring_sqe * rp_uring_get_sqe(rp_uring_t *ring);
+
+// submit the queued sqes and wait for at least wait_nr completions or
+// timeout ms, -1 waits without a timeout. returns -1 on error.
+int rp_uring_enter(rp_uring_t *ring, unsigned wait_nr, int timeout);
+
+// the next completion or NULL, hand it back with rp_uring_cqe_seen.
+static inline struct io_uring_cqe *
+rp_uring_peek_cqe(rp_uring_t *ring)
+{
+	unsigned head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+static inline void
+rp_uring_cqe_seen(rp_uring_t *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif // RP_URING_H
@@ -2,11 +2,16 @@ sp             := $(sp).x
 dirstack_$(sp) := $(d)
 d              := $(dir)
 
-OBJS_$(d) := $(d)/rp_fifo.o \
+OBJS_$(d) := $(d)/rp_chain.o \
+             $(d)/rp_chash.o \
+             $(d)/rp_fifo.o \
              $(d)/rp_os.o \
              $(d)/rp_palloc.o \
+             $(d)/rp_scan.o \
              $(d)/rp_slab.o \
-             $(d)/rp_string.o
+             $(d)/rp_string.o \
+             $(d)/rp_timer.o \
+             $(d)/rp_uring.o
 
 DEPS_$(d) := $(OBJS_$(d):%=%.d)
 CLEAN := $(CLEAN) $(OBJS_$(d)) $(DEPS_$(d)) $(d)/util.a
@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <rpbot.h>
+#include <rp_os.h>
+#include <rp_event.h>
+#include <rp_dns.h>
+
+// resolver test against a stand-in nameserver on 127.0.0.1. the server
+// answers from a fixed zone over udp and tcp on the same port:
+//
+//   a.test      A 192.0.2.1, AAAA 2001:db8::1
+//   big.test    20 A records, truncated over udp
+//   cname.test  CNAME to a.test followed by its A record
+//   nx.test     NXDOMAIN
+//   lost.test   the first udp question of each type is dropped
+//
+// every lookup is checked for its addresses, of which RP_DNS_MAX_ADDRS
+// are kept. cached names must not reach the server again and a second
+// resolver has to answer from the cache file alone once the server is
+// gone.
+
+#define TTL 300
+
+struct server {
+	int      udp_fd;
+	int      tcp_fd;
+	uint16_t port;
+	unsigned questions; // every question received
+	unsigned dropped;
+	int      stop;
+};
+
+struct result {
+	int    done;
+	size_t n_addrs;
+	char   addrs[RP_DNS_MAX_ADDRS][INET6_ADDRSTRLEN];
+};
+
+__thread uintptr_t rp_current_msec;
+
+static int failed;
+
+void
+rp_updatetime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	rp_current_msec = (uintptr_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static size_t
+put_rr(u_char *p, uint16_t type, const void *data, size_t len)
+{
+	size_t n = 0;
+
+	p[n++] = 0xc0; // the name of the question
+	p[n++] = 12;
+	p[n++] = type >> 8;
+	p[n++] = type & 0xff;
+	p[n++] = 0;
+	p[n++] = 1;
+	p[n++] = 0;
+	p[n++] = 0;
+	p[n++] = TTL >> 8;
+	p[n++] = TTL & 0xff;
+	p[n++] = len >> 8;
+	p[n++] = len & 0xff;
+	memcpy(p + n, data, len);
+
+	return n + len;
+}
+
+// build the answer to the question in q, returns its length or 0 to
+// drop it.
+static size_t
+answer(struct server *srv, const u_char *q, size_t len, u_char *p, int tcp)
+{
+	char name[256];
+	size_t off = 12, n = 0, out;
+	unsigned an = 0, i;
+	int rcode = 0, truncated = 0;
+
+	while (off < len && q[off] != 0 && n + q[off] + 1 < sizeof(name)) {
+		if (n) {
+			name[n++] = '.';
+		}
+
+		memcpy(name + n, q + off + 1, q[off]);
+		n += q[off];
+		off += q[off] + 1;
+	}
+
+	name[n] = '\0';
+	off++;
+
+	if (off + 4 > len) {
+		return 0;
+	}
+
+	uint16_t type = q[off] << 8 | q[off + 1];
+	off += 4;
+
+	__atomic_add_fetch(&srv->questions, 1, __ATOMIC_RELAXED);
+
+	// the header and the question, without the opt record
+	memcpy(p, q, off);
+	p[4] = 0;
+	p[5] = 1;
+	memset(p + 6, 0, 6);
+	out = off;
+
+	u_char a[4] = { 192, 0, 2, 1 };
+	u_char aaaa[16] = { 0x20, 0x01, 0x0d, 0xb8, [15] = 1 };
+
+	if (strcmp(name, "a.test") == 0 || strcmp(name, "lost.test") == 0) {
+		if (strcmp(name, "lost.test") == 0 && !tcp &&
+		    __atomic_add_fetch(&srv->dropped, 1, __ATOMIC_RELAXED) <= 2) {
+			return 0;
+		}
+
+		if (type == 1) {
+			out += put_rr(p + out, 1, a, 4);
+			an++;
+		} else if (type == 28) {
+			out += put_rr(p + out, 28, aaaa, 16);
+			an++;
+		}
+	} else if (strcmp(name, "cname.test") == 0) {
+		static const u_char target[] = "\1a\4test";
+
+		out += put_rr(p + out, 5, target, sizeof(target));
+		an++;
+
+		if (type == 1) {
+			out += put_rr(p + out, 1, a, 4);
+			an++;
+		}
+	} else if (strcmp(name, "big.test") == 0) {
+		if (!tcp) {
+			truncated = 1;
+		} else if (type == 1) {
+			for (i = 0; i < 20; i++) {
+				a[3] = i + 1;
+				out += put_rr(p + out, 1, a, 4);
+				an++;
+			}
+		}
+	} else {
+		rcode = 3;
+	}
+
+	p[2] = 0x81 | (truncated ? 0x02 : 0);
+	p[3] = 0x80 | rcode;
+	p[6] = an >> 8;
+	p[7] = an & 0xff;
+
+	return out;
+}
+
+static void
+serve_tcp(struct server *srv, int fd)
+{
+	u_char in[1024], out[2048];
+	size_t len = 0;
+	ssize_t n;
+
+	while ((n = read(fd, in + len, sizeof(in) - len)) > 0) {
+		len += n;
+
+		while (len >= 2 && len >= 2 + (size_t)(in[0] << 8 | in[1])) {
+			size_t q_len = in[0] << 8 | in[1];
+			size_t a_len = answer(srv, in + 2, q_len, out + 2, 1);
+
+			out[0] = a_len >> 8;
+			out[1] = a_len & 0xff;
+
+			if (write(fd, out, a_len + 2) != (ssize_t)(a_len + 2)) {
+				return;
+			}
+
+			len -= q_len + 2;
+			memmove(in, in + q_len + 2, len);
+		}
+	}
+}
+
+static void *
+server_thread(void *arg)
+{
+	struct server *srv = arg;
+	struct pollfd fds[2] = {
+		{ srv->udp_fd, POLLIN, 0 },
+		{ srv->tcp_fd, POLLIN, 0 },
+	};
+
+	while (!__atomic_load_n(&srv->stop, __ATOMIC_ACQUIRE)) {
+		if (poll(fds, 2, 50) <= 0) {
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			struct sockaddr_storage from;
+			socklen_t from_len = sizeof(from);
+			u_char in[1024], out[2048];
+			ssize_t n = recvfrom(srv->udp_fd, in, sizeof(in), 0,
+			                     (struct sockaddr *)&from, &from_len);
+			size_t len;
+
+			if (n > 0 && (len = answer(srv, in, n, out, 0)) > 0) {
+				sendto(srv->udp_fd, out, len, 0,
+				       (struct sockaddr *)&from, from_len);
+			}
+		}
+
+		if (fds[1].revents & POLLIN) {
+			int fd = accept(srv->tcp_fd, NULL, NULL);
+
+			if (fd != -1) {
+				serve_tcp(srv, fd);
+				close(fd);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static int
+server_start(struct server *srv)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+
+	memset(srv, 0, sizeof(*srv));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	srv->udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	srv->tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	// tcp takes the port udp got
+	if (bind(srv->udp_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    getsockname(srv->udp_fd, (struct sockaddr *)&addr, &addr_len) == -1 ||
+	    bind(srv->tcp_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(srv->tcp_fd, 4) == -1) {
+		perror("server_start");
+		return -1;
+	}
+
+	srv->port = ntohs(addr.sin_port);
+
+	return 0;
+}
+
+static void
+handle_result(void *data, const struct rp_dns_addr *addrs, size_t n_addrs)
+{
+	struct result *r = data;
+	size_t i;
+
+	r->done = 1;
+	r->n_addrs = n_addrs;
+
+	for (i = 0; i < n_addrs; i++) {
+		const void *a = addrs[i].u.sa.sa_family == AF_INET6
+		              ? (const void *)&addrs[i].u.in6.sin6_addr
+		              : (const void *)&addrs[i].u.in.sin_addr;
+
+		inet_ntop(addrs[i].u.sa.sa_family, a, r->addrs[i], INET6_ADDRSTRLEN);
+	}
+}
+
+// resolve name and poll until the answer is in, returns the number of
+// questions that reached the server.
+static unsigned
+resolve(struct rp_event_ctx *ev, struct server *srv, const char *name,
+	struct result *r)
+{
+	struct rp_dns_query *q;
+	unsigned before = __atomic_load_n(&srv->questions, __ATOMIC_RELAXED);
+
+	memset(r, 0, sizeof(*r));
+
+	if (rp_dns_resolve(rp_event_dns(ev), name, handle_result, r, &q)) {
+		return 0;
+	}
+
+	while (!r->done) {
+		struct rp_events evs;
+
+		memset(&evs, 0, sizeof(evs));
+		rp_event_poll(ev, &evs, -1);
+	}
+
+	return __atomic_load_n(&srv->questions, __ATOMIC_RELAXED) - before;
+}
+
+static void
+check(int ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+
+	if (!ok) {
+		failed = 1;
+	}
+}
+
+static void
+check_addrs(const struct result *r, const char *name, size_t n,
+	const char *first, const char *last)
+{
+	char what[256];
+
+	snprintf(what, sizeof(what), "%s has %zu addresses (%zu)", name, n,
+	         r->n_addrs);
+	check(r->n_addrs == n, what);
+
+	if (r->n_addrs == n && n > 0) {
+		snprintf(what, sizeof(what), "%s starts with %s (%s)", name,
+		         first, r->addrs[0]);
+		check(strcmp(r->addrs[0], first) == 0, what);
+
+		snprintf(what, sizeof(what), "%s ends with %s (%s)", name,
+		         last, r->addrs[n - 1]);
+		check(strcmp(r->addrs[n - 1], last) == 0, what);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct rp_event_ctx *ev;
+	struct server srv;
+	struct result r;
+	pthread_t thread;
+	char ns[32], cache[] = "/tmp/rp_dns_test.XXXXXX";
+	unsigned n;
+	int fd;
+
+	(void)argc;
+	(void)argv;
+
+	rp_os_init();
+	rp_updatetime();
+
+	if (server_start(&srv) || (fd = mkstemp(cache)) == -1) {
+		return 1;
+	}
+
+	close(fd);
+	snprintf(ns, sizeof(ns), "127.0.0.1#%u", srv.port);
+
+	rp_pool_t *pool = rp_create_pool(RP_DEFAULT_POOL_SIZE);
+
+	rp_event_init(pool, 0, &ev);
+
+	if (rp_dns_nameserver(rp_event_dns(ev), ns) ||
+	    rp_dns_cache_file(rp_event_dns(ev), cache)) {
+		return 1;
+	}
+
+	pthread_create(&thread, NULL, server_thread, &srv);
+
+	n = resolve(ev, &srv, "a.test", &r);
+	check_addrs(&r, "a.test", 2, "2001:db8::1", "192.0.2.1");
+	check(n == 2, "a.test asks for A and AAAA");
+
+	n = resolve(ev, &srv, "A.Test.", &r);
+	check_addrs(&r, "A.Test.", 2, "2001:db8::1", "192.0.2.1");
+	check(n == 0, "A.Test. is answered from the cache");
+
+	n = resolve(ev, &srv, "big.test", &r);
+	check_addrs(&r, "big.test", RP_DNS_MAX_ADDRS, "192.0.2.1", "192.0.2.16");
+	check(n == 4, "big.test is asked again over tcp");
+
+	n = resolve(ev, &srv, "cname.test", &r);
+	check_addrs(&r, "cname.test", 1, "192.0.2.1", "192.0.2.1");
+
+	n = resolve(ev, &srv, "nx.test", &r);
+	check_addrs(&r, "nx.test", 0, NULL, NULL);
+
+	n = resolve(ev, &srv, "nx.test", &r);
+	check(n > 0, "nx.test is not cached");
+
+	n = resolve(ev, &srv, "lost.test", &r);
+	check_addrs(&r, "lost.test", 2, "2001:db8::1", "192.0.2.1");
+	// the second question of nx.test may only be counted now
+	check(n >= 4, "lost.test is asked again after the timeout");
+
+	n = resolve(ev, &srv, "127.0.0.1", &r);
+	check_addrs(&r, "127.0.0.1", 1, "127.0.0.1", "127.0.0.1");
+	check(n == 0, "ip literals are not looked up");
+
+	__atomic_store_n(&srv.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+
+	// a new resolver with nobody listening gets by on the file
+	struct rp_event_ctx *ev2;
+
+	rp_event_init(pool, 0, &ev2);
+
+	if (rp_dns_nameserver(rp_event_dns(ev2), ns) ||
+	    rp_dns_cache_file(rp_event_dns(ev2), cache)) {
+		return 1;
+	}
+
+	n = resolve(ev2, &srv, "big.test", &r);
+	check_addrs(&r, "big.test", RP_DNS_MAX_ADDRS, "192.0.2.1", "192.0.2.16");
+	check(n == 0, "big.test is answered from the cache file");
+
+	unlink(cache);
+	rp_destroy_pool(pool);
+
+	return failed;
+}
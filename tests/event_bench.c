@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <rpbot.h>
+#include <rp_os.h>
+#include <rp_fifo.h>
+#include <rp_chain.h>
+#include <rp_scan.h>
+#include <rp_event.h>
+
+// loopback benchmark of the event loop backends. a server thread answers
+// every "PING :n" with BURST-1 privmsgs followed by "PONG :n", the client
+// is a regular rp_event connection that sends the next ping once the
+// pong arrived. the syscalls the event loop made per received message
+// and the round trip latency are printed as one json object per backend.
+
+struct bench_opts {
+	size_t       rounds;
+	size_t       burst;
+	unsigned int backends; // RP_EVENT_URING bit set: uring, 1: epoll
+};
+
+struct bench_server {
+	int    listen_fd;
+	size_t burst;
+};
+
+__thread uintptr_t rp_current_msec;
+
+void
+rp_updatetime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	rp_current_msec = (uintptr_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// answer pings on one connection until the client hangs up
+static void *
+server_thread(void *arg)
+{
+	struct bench_server *srv = arg;
+	char in[4096], *out;
+	size_t in_len = 0, i;
+	int fd;
+
+	if ((fd = accept(srv->listen_fd, NULL, NULL)) == -1) {
+		perror("accept()");
+		return NULL;
+	}
+
+	// pongs are small writes, nagle would hold them back for the ack
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	out = malloc(srv->burst * 64 + 64);
+
+	while (1) {
+		ssize_t n = read(fd, in + in_len, sizeof(in) - in_len);
+		const char *p = in, *eol;
+
+		if (n <= 0) {
+			break;
+		}
+
+		in_len += n;
+
+		while ((eol = rp_scan_crlf(p, in + in_len - p)) != NULL) {
+			size_t out_len = 0;
+
+			for (i = 1; i < srv->burst; i++) {
+				out_len += sprintf(out + out_len,
+				                   ":nick!user@host PRIVMSG #bench :line %zu\r\n", i);
+			}
+
+			out_len += sprintf(out + out_len, "PONG %.*s\r\n",
+			                   (int)(eol - p - 5), p + 5);
+
+			if (write(fd, out, out_len) != (ssize_t)out_len) {
+				goto done;
+			}
+
+			p = eol + 2;
+		}
+
+		in_len -= p - in;
+		memmove(in, p, in_len);
+	}
+
+done:
+	free(out);
+	close(fd);
+
+	return NULL;
+}
+
+static int
+run(const struct bench_opts *opts, unsigned flags, const char *name)
+{
+	struct bench_server srv;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	pthread_t thread;
+	char port[16];
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	srv.burst = opts->burst;
+	srv.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (srv.listen_fd == -1 ||
+	    bind(srv.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+	    listen(srv.listen_fd, 1) == -1 ||
+	    getsockname(srv.listen_fd, (struct sockaddr *)&addr, &addr_len) == -1) {
+		perror("listen");
+		return -1;
+	}
+
+	// the event loop only needs the server of the config
+	struct rp_config_server server;
+	struct rp_config cfg;
+
+	snprintf(port, sizeof(port), "%u", ntohs(addr.sin_port));
+
+	memset(&cfg, 0, sizeof(cfg));
+	memset(&server, 0, sizeof(server));
+	server.host.ptr = "127.0.0.1";
+	server.host.len = strlen(server.host.ptr);
+	server.port.ptr = port;
+	server.port.len = strlen(port);
+	cfg.servers = &server;
+
+	rp_pool_t *pool = rp_create_pool(RP_DEFAULT_POOL_SIZE);
+	rp_fifo_t *read_buf = rp_palloc(pool, sizeof(*read_buf) + 16 * 1024);
+	rp_chain_t *write_buf = rp_palloc(pool, sizeof(*write_buf));
+	rp_chain_free_t chunks;
+	struct rp_event_ctx *ev;
+	struct rp_conn *conn;
+
+	read_buf->capacity = 16 * 1024;
+	rp_fifo_init(read_buf);
+	rp_chain_free_init(&chunks, 16);
+	rp_chain_init(write_buf, &chunks, 64 * 1024);
+
+	rp_updatetime();
+	rp_event_init(pool, flags, &ev);
+	rp_event_add_conn(ev, &cfg, read_buf, write_buf, &conn);
+
+	// started after the event context blocked its signals
+	pthread_create(&thread, NULL, server_thread, &srv);
+
+	double *rtt = malloc(opts->rounds * sizeof(*rtt));
+	struct rp_event_stats start, end;
+	char line[64], in[16 * 1024];
+	size_t in_len = 0, round = 0, msgs = 0;
+	double sent_at = 0, t0 = 0;
+
+	while (round < opts->rounds) {
+		struct rp_events evs;
+		memset(&evs, 0, sizeof(evs));
+
+		if (rp_event_poll(ev, &evs, -1) < 0 || conn->evs.disconnected) {
+			fprintf(stderr, "%s: connection lost\n", name);
+			return -1;
+		}
+
+		if (conn->evs.connected) {
+			rp_event_stats(ev, &start);
+			t0 = now_sec();
+			sent_at = t0;
+			rp_chain_put(write_buf, line, sprintf(line, "PING :0\r\n"));
+		}
+
+		in_len += rp_fifo_get(read_buf, in + in_len, sizeof(in) - in_len);
+
+		const char *p = in, *eol;
+
+		while ((eol = rp_scan_crlf(p, in + in_len - p)) != NULL) {
+			msgs++;
+
+			if (strncmp(p, "PONG ", 5) == 0) {
+				rtt[round++] = now_sec() - sent_at;
+
+				if (round < opts->rounds) {
+					sent_at = now_sec();
+					rp_chain_put(write_buf, line,
+					             sprintf(line, "PING :%zu\r\n", round));
+				}
+			}
+
+			p = eol + 2;
+		}
+
+		in_len -= p - in;
+		memmove(in, p, in_len);
+	}
+
+	double t = now_sec() - t0;
+	rp_event_stats(ev, &end);
+
+	qsort(rtt, opts->rounds, sizeof(*rtt), cmp_double);
+
+	double sum = 0;
+	size_t i;
+
+	for (i = 0; i < opts->rounds; i++) {
+		sum += rtt[i];
+	}
+
+	unsigned long syscalls = end.syscalls - start.syscalls;
+	unsigned long reads = end.reads - start.reads;
+	unsigned long writes = end.writes - start.writes;
+	unsigned long bytes_in = end.bytes_in - start.bytes_in;
+	unsigned long bytes_out = end.bytes_out - start.bytes_out;
+
+	printf("{\"backend\": \"%s\", \"rounds\": %zu, \"msgs\": %zu, \"secs\": %.6f, "
+	       "\"syscalls\": %lu, \"syscalls_per_msg\": %.3f, "
+	       "\"syscalls_per_kb\": %.3f, \"bytes_per_read\": %.1f, "
+	       "\"bytes_per_write\": %.1f, "
+	       "\"rtt_avg_us\": %.2f, \"rtt_p50_us\": %.2f, \"rtt_p99_us\": %.2f}\n",
+	       name, opts->rounds, msgs, t,
+	       syscalls, (double)syscalls / msgs,
+	       (double)syscalls * 1024 / (bytes_in + bytes_out),
+	       reads ? (double)bytes_in / reads : 0.0,
+	       writes ? (double)bytes_out / writes : 0.0,
+	       sum / opts->rounds * 1e6,
+	       rtt[opts->rounds / 2] * 1e6,
+	       rtt[opts->rounds * 99 / 100] * 1e6);
+
+	// hanging up ends the server thread
+	shutdown(conn->sock_fd, SHUT_RDWR);
+	pthread_join(thread, NULL);
+	close(srv.listen_fd);
+
+	rp_event_destroy(ev);
+	free(rtt);
+	rp_chain_reset(write_buf);
+	rp_chain_free_release(&chunks);
+	rp_destroy_pool(pool);
+
+	return 0;
+}
+
+static void
+usage(void)
+{
+	printf("\n");
+	printf("Usage: event_bench [-n ROUNDS] [-b BURST] [-e epoll|uring]\n\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_opts opts = { 20000, 1, 1 | RP_EVENT_URING };
+	int c;
+
+	while ((c = getopt(argc, argv, "n:b:e:h")) != -1) {
+		switch (c) {
+		case 'n':
+			opts.rounds = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			opts.burst = strtoul(optarg, NULL, 10);
+			break;
+		case 'e':
+			if (strcmp(optarg, "epoll") == 0) {
+				opts.backends = 1;
+			} else if (strcmp(optarg, "uring") == 0) {
+				opts.backends = RP_EVENT_URING;
+			} else {
+				usage();
+				return 1;
+			}
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (opts.rounds == 0 || opts.burst == 0) {
+		usage();
+		return 1;
+	}
+
+	rp_os_init();
+	rp_scan_init();
+
+	if ((opts.backends & 1) && run(&opts, 0, "epoll")) {
+		return 1;
+	}
+
+	if ((opts.backends & RP_EVENT_URING) &&
+	    run(&opts, RP_EVENT_URING, "uring")) {
+		return 1;
+	}
+
+	return 0;
+}
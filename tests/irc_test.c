@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <rp_os.h>
+#include <rp_palloc.h>
+#include <rp_chain.h>
+#include <rp_config.h>
+#include <rp_irc.h>
+
+// connection test without a server. the lines a connection would send
+// are read back from its write buffer after feeding it what the server
+// says or after sending and flushing at a given time. rp_current_msec
+// only moves when a test sets it.
+//
+// long text is split into lines of at most RP_IRC_LINE_SZ bytes, at a
+// space if there is one and never inside of a utf-8 sequence. a param
+// that would break the line is refused and so is a line that does not
+// fit, neither leaves anything in the write buffer.
+//
+// a standby registers like any other connection but must not join the
+// channels before it is promoted. flood control lets a burst of
+// IRC_FLOOD_BURST / IRC_FLOOD_COST lines through and holds back the
+// rest, except keepalive and registration. held moderation goes first,
+// then the targets take turns a line at a time.
+
+#define WELCOME ":irc.test 001 rpbot :Welcome\r\n" \
+                ":irc.test 004 rpbot irc.test ircd-1 iow ov\r\n"
+
+__thread uintptr_t rp_current_msec;
+
+static int failed;
+
+void
+rp_updatetime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+	rp_current_msec = (uintptr_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+check(int ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+
+	if (!ok) {
+		failed = 1;
+	}
+}
+
+// everything in the write buffer as a string, the buffer is drained.
+static size_t
+take(rp_chain_t *buf, char *out, size_t size)
+{
+	struct iovec iov[16];
+	size_t len = 0;
+	int i, cnt;
+
+	cnt = rp_chain_iov(buf, iov, 16);
+
+	for (i = 0; i < cnt && len + iov[i].iov_len < size; i++) {
+		memcpy(out + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+
+	out[len] = '\0';
+	rp_chain_reset(buf);
+
+	return len;
+}
+
+static unsigned
+count_lines(const char *s)
+{
+	unsigned n = 0;
+
+	while ((s = strstr(s, "\r\n")) != NULL) {
+		s += 2;
+		n++;
+	}
+
+	return n;
+}
+
+// whether the write buffer holds a line that starts with cmd, the
+// buffer is drained either way.
+static int
+sent(rp_chain_t *buf, const char *cmd)
+{
+	char out[4096], *line, *next;
+	size_t n = strlen(cmd);
+	int found = 0;
+
+	take(buf, out, sizeof(out));
+
+	for (line = out; line && *line; line = next) {
+		next = strstr(line, "\r\n");
+		next = next ? next + 2 : NULL;
+
+		if (!strncmp(line, cmd, n) && line[n] == ' ') {
+			found = 1;
+		}
+	}
+
+	return found;
+}
+
+static void
+feed(struct rp_irc_ctx *irc, const char *lines)
+{
+	size_t len = strlen(lines);
+
+	rp_irc_process(irc, lines, &len);
+}
+
+// the text of every line in out that starts with prefix, joined by sep.
+// returns -1 if a line is longer than RP_IRC_LINE_SZ or does not start
+// with prefix.
+static int
+join_text(const char *out, const char *prefix, const char *sep,
+	char *text, size_t size)
+{
+	size_t n = strlen(prefix), len = 0;
+	const char *line, *end;
+
+	text[0] = '\0';
+
+	for (line = out; *line; line = end + 2) {
+		if ((end = strstr(line, "\r\n")) == NULL ||
+		    (size_t)(end + 2 - line) > RP_IRC_LINE_SZ ||
+		    strncmp(line, prefix, n) != 0) {
+			return -1;
+		}
+
+		if (len + strlen(sep) + (size_t)(end - line) >= size) {
+			return -1;
+		}
+
+		len += (size_t)sprintf(text + len, "%s%.*s", line == out ? "" : sep,
+		                       (int)(end - line - n), line + n);
+	}
+
+	return 0;
+}
+
+static void
+test_lines(struct rp_irc_ctx *irc, rp_chain_t *buf)
+{
+	static const char *bad[] = {
+		"two words", ":colon", "cr\r", "lf\nlf", "",
+	};
+	char out[4096], words[1200], utf8[800], text[1600], param[503];
+	rp_str_t msg, chan = rp_string("#c"), target, str;
+	const char *p;
+	unsigned i;
+	int ok;
+
+	// every line moves the clock, a minute later it caught up again
+	rp_current_msec = 1000000;
+
+	for (i = 0; i < sizeof(words) - 1; i++) {
+		words[i] = i % 10 == 9 ? ' ' : 'a' + i % 10;
+	}
+
+	words[i] = '\0';
+	msg.ptr = words;
+	msg.len = strlen(words);
+
+	ok = rp_irc_send(irc, "PRIVMSG", &msg, &chan, NULL) == 0;
+	take(buf, out, sizeof(out));
+	check(ok && count_lines(out) == 3 &&
+	      !join_text(out, "PRIVMSG #c :", " ", text, sizeof(text)) &&
+	      !strcmp(text, words), "long text is split at spaces");
+
+	// two byte sequences and an odd number of bytes of room for them
+	for (i = 0; i < sizeof(utf8); i += 2) {
+		utf8[i] = (char)0xc3;
+		utf8[i + 1] = (char)0xa9;
+	}
+
+	msg.ptr = utf8;
+	msg.len = sizeof(utf8);
+	target = (rp_str_t)rp_string("#ch");
+	rp_current_msec += 60000;
+
+	ok = rp_irc_send(irc, "PRIVMSG", &msg, &target, NULL) == 0;
+	take(buf, out, sizeof(out));
+
+	for (p = out; ok && (p = strstr(p, " :")) != NULL; p += 2) {
+		ok = ((u_char)p[2] & 0xc0) != 0x80;
+	}
+
+	check(ok && count_lines(out) == 2 &&
+	      !join_text(out, "PRIVMSG #ch :", "", text, sizeof(text)) &&
+	      !memcmp(text, utf8, sizeof(utf8)) && strlen(text) == sizeof(utf8),
+	      "utf-8 text is split between sequences");
+
+	rp_current_msec += 60000;
+
+	for (i = 0, ok = 1; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		str.ptr = (char *)bad[i];
+		str.len = strlen(bad[i]);
+		ok &= rp_irc_send(irc, "PRIVMSG", &msg, &str, NULL) == -1;
+	}
+
+	check(ok && rp_chain_count(buf) == 0, "bad middle params are refused");
+
+	str = (rp_str_t)rp_string("a\r\nQUIT");
+	check(rp_irc_send(irc, "PRIVMSG", &str, &chan, NULL) == -1 &&
+	      rp_chain_count(buf) == 0, "text with a line break is refused");
+
+	// "PRIVMSG " and a param of 502 bytes make 510, the crlf 512
+	memset(param, 'x', sizeof(param));
+	str.ptr = param;
+	str.len = 502;
+	msg = (rp_str_t)rp_string("x");
+
+	check(rp_irc_send(irc, "PRIVMSG", NULL, &str, NULL) == 0 &&
+	      take(buf, out, sizeof(out)) == RP_IRC_LINE_SZ,
+	      "a line of RP_IRC_LINE_SZ goes out");
+
+	str.len = 503;
+	check(rp_irc_send(irc, "PRIVMSG", NULL, &str, NULL) == -1 &&
+	      rp_chain_count(buf) == 0, "a line that does not fit is refused");
+
+	str.len = 500;
+	check(rp_irc_send(irc, "PRIVMSG", &msg, &str, NULL) == -1 &&
+	      rp_chain_count(buf) == 0, "text without room is refused");
+
+	rp_irc_destroy(irc);
+}
+
+static int
+privmsg(struct rp_irc_ctx *irc, rp_str_t *target)
+{
+	rp_str_t text = rp_string("hi");
+
+	return rp_irc_send(irc, "PRIVMSG", &text, target, NULL);
+}
+
+static void
+test_flood(struct rp_irc_ctx *irc, rp_chain_t *buf)
+{
+	static const char *turns[] = {
+		"KICK #a someone\r\n",
+		"PRIVMSG #a :hi\r\n",
+		"PRIVMSG #b :hi\r\n",
+		"PRIVMSG #a :hi\r\n",
+		"PRIVMSG #b :hi\r\n",
+	};
+	rp_str_t a = rp_string("#a"), b = rp_string("#b");
+	rp_str_t someone = rp_string("someone"), token = rp_string("x");
+	struct rp_irc_stats stats;
+	uintptr_t start, next = 0;
+	char out[4096], what[64];
+	unsigned i, n;
+	int ok, rc;
+
+	rp_current_msec = start = 1000000;
+
+	for (i = 0, ok = 1; i < 5; i++) {
+		ok &= privmsg(irc, &a) == 0;
+	}
+
+	take(buf, out, sizeof(out));
+	check(ok && count_lines(out) == 5, "a burst of 5 goes out at once");
+
+	ok = privmsg(irc, &a) == 0 && privmsg(irc, &a) == 0 &&
+	     privmsg(irc, &b) == 0 && privmsg(irc, &b) == 0;
+	rp_irc_stats(irc, &stats);
+	check(ok && rp_chain_count(buf) == 0 && stats.delayed == 4,
+	      "the burst is cut off after the allowance");
+
+	ok = rp_irc_send(irc, "PONG", &token, NULL) == 0 &&
+	     rp_irc_send(irc, "NICK", NULL, &someone, NULL) == 0;
+	take(buf, out, sizeof(out));
+	check(ok && !strcmp(out, "PONG :x\r\nNICK someone\r\n"),
+	      "PONG and NICK skip the queue");
+
+	check(rp_irc_send(irc, "KICK", NULL, &a, &someone, NULL) == 0 &&
+	      rp_chain_count(buf) == 0, "KICK waits behind the burst");
+
+	// 7 lines moved the clock 14 s ahead, a line may go at 8 s
+	rc = rp_irc_flush(irc, &next);
+	check(rc == 1 && rp_chain_count(buf) == 0 && next == start + 6000,
+	      "flush waits until the clock has caught up");
+
+	rp_current_msec = next - 1;
+	rc = rp_irc_flush(irc, &next);
+	check(rc == 1 && rp_chain_count(buf) == 0,
+	      "flush sends nothing before next");
+
+	for (i = 0; i < sizeof(turns) / sizeof(turns[0]); i++) {
+		rp_current_msec = next;
+		rc = rp_irc_flush(irc, &next);
+		take(buf, out, sizeof(out));
+
+		snprintf(what, sizeof(what), "held line %u is %.*s", i,
+		         (int)strlen(turns[i]) - 2, turns[i]);
+		check(!strcmp(out, turns[i]) &&
+		      (rc == 0 || next == rp_current_msec + 2000), what);
+	}
+
+	check(rc == 0, "flush is done once the queue is empty");
+
+	for (n = 0; n < RP_IRC_QUEUE_MAX + 1; n++) {
+		if (privmsg(irc, n % 2 ? &a : &b)) {
+			break;
+		}
+	}
+
+	check(n == RP_IRC_QUEUE_MAX && rp_chain_count(buf) == 0,
+	      "rp_irc_send fails once the queue is full");
+	check(rp_irc_send(irc, "PONG", &token, NULL) == 0 &&
+	      sent(buf, "PONG"), "PONG goes out with a full queue");
+
+	rp_irc_destroy(irc);
+}
+
+int
+main(int argc, char **argv)
+{
+	rp_str_list_t nick = { rp_string("rpbot"), NULL };
+	struct rp_config_channel chan = { rp_string("#test"), rp_string(""), NULL };
+	struct rp_config cfg;
+	struct rp_irc_ctx *active, *standby, *irc;
+	rp_chain_free_t chunks;
+	rp_chain_t active_buf, standby_buf, buf;
+	rp_pool_t *pool;
+
+	(void)argc;
+	(void)argv;
+
+	rp_os_init();
+	rp_updatetime();
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.identity.nicks = &nick;
+	cfg.identity.name = (rp_str_t)rp_string("rpbot");
+	cfg.identity.login = (rp_str_t)rp_string("rpbot");
+	cfg.channels = &chan;
+
+	pool = rp_create_pool(RP_DEFAULT_POOL_SIZE);
+	if (!pool) {
+		return 1;
+	}
+
+	rp_chain_free_init(&chunks, 16);
+	rp_chain_init(&active_buf, &chunks, 1 << 16);
+	rp_chain_init(&standby_buf, &chunks, 1 << 16);
+
+	rp_irc_init(pool, &cfg, &active_buf, &active);
+	rp_irc_init(pool, &cfg, &standby_buf, &standby);
+	rp_irc_set_standby(standby, 1);
+
+	check(!rp_irc_onconnect(active) && sent(&active_buf, "NICK"),
+	      "active registers");
+	check(!rp_irc_onconnect(standby) && sent(&standby_buf, "NICK"),
+	      "standby registers");
+
+	feed(active, WELCOME);
+	feed(standby, WELCOME);
+
+	check(rp_irc_registered(active), "active is registered");
+	check(rp_irc_registered(standby), "standby is registered");
+	check(sent(&active_buf, "JOIN"), "active joins");
+	check(!sent(&standby_buf, "JOIN"), "standby does not join");
+
+	rp_str_t text = rp_string("hello");
+	rp_str_t target = rp_string("#test");
+
+	check(rp_irc_send(standby, "PRIVMSG", &text, &target, NULL) == -1 &&
+	      !sent(&standby_buf, "PRIVMSG"), "standby does not talk");
+
+	feed(standby, "PING :irc.test\r\n");
+	check(sent(&standby_buf, "PONG"), "standby answers PING");
+
+	// taking over from the active connection
+	rp_irc_set_standby(active, 1);
+	rp_irc_set_standby(standby, 0);
+
+	check(sent(&standby_buf, "JOIN"), "promoted standby joins");
+	check(!sent(&active_buf, "JOIN"), "demoted connection does not join");
+
+	// a standby that is promoted before registering joins on 004
+	rp_irc_onconnect(active);
+	rp_irc_set_standby(active, 0);
+	check(!sent(&active_buf, "JOIN"), "unregistered connection does not join");
+
+	feed(active, WELCOME);
+	check(sent(&active_buf, "JOIN"), "promoted connection joins once welcomed");
+
+	// our membership comes from the NAMES reply, with the server's prefixes
+	rp_str_t other = rp_string("#other");
+
+	check(rp_irc_membership(active, &target) == -1, "not in a channel yet");
+
+	feed(active, ":irc.test 005 rpbot PREFIX=(qov)*@+ :are supported\r\n"
+	     ":irc.test 353 rpbot = #TEST :*someone +other\r\n"
+	     ":irc.test 353 rpbot = #test :@+rpbot\r\n"
+	     ":irc.test 353 rpbot = #other :*rpbot\r\n");
+	check(rp_irc_membership(active, &target) == '@',
+	      "membership prefix from NAMES");
+	check(rp_irc_membership(active, &other) == -1,
+	      "channels that are not configured are not kept");
+
+	rp_irc_onconnect(active);
+	check(rp_irc_membership(active, &target) == -1,
+	      "membership is forgotten on a new connection");
+
+	rp_irc_destroy(active);
+	rp_irc_destroy(standby);
+	rp_chain_reset(&active_buf);
+	rp_chain_reset(&standby_buf);
+
+	rp_chain_init(&buf, &chunks, 1 << 16);
+
+	rp_irc_init(pool, &cfg, &buf, &irc);
+	test_lines(irc, &buf);
+
+	rp_irc_init(pool, &cfg, &buf, &irc);
+	test_flood(irc, &buf);
+	rp_chain_reset(&buf);
+
+	rp_chain_free_release(&chunks);
+	rp_destroy_pool(pool);
+
+	return failed;
+}
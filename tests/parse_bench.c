@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <rp_fifo.h>
+#include <rp_scan.h>
+#include <rp_ircsm.h>
+
+// parser throughput benchmark. a corpus is generated (or loaded with -f)
+// and fed through a fifo in random chunk sizes, the way rpbot reads from
+// the socket, then parsed the way main_loop does. the result is printed
+// as a single json object.
+
+#define BATCH_SZ 64
+
+// the longest line gen_line writes, crlf included
+#define LINE_SZ 512
+
+struct bench_opts {
+	size_t       lines;
+	unsigned int mix[4]; // privmsg, numeric, tagged, long params
+	size_t       max_chunk;
+	size_t       capacity;
+	unsigned int seed;
+	const char  *corpus_in;
+	const char  *corpus_out;
+};
+
+static const char *words[] = {
+	"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "irc",
+	"bot", "hello", "world", "netsplit", "again", "lol", "ok", "anyone",
+	"here", "channel", "topic",
+};
+
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// append random words to p until about n bytes are written
+static size_t
+gen_text(char *p, size_t n)
+{
+	size_t len = 0;
+
+	while (len < n) {
+		const char *w = words[rand() % NWORDS];
+		len += sprintf(p + len, len ? " %s" : "%s", w);
+	}
+
+	return len;
+}
+
+static size_t
+gen_line(char *p, const struct bench_opts *opts)
+{
+	unsigned int total = opts->mix[0] + opts->mix[1] + opts->mix[2] + opts->mix[3];
+	unsigned int r = rand() % total;
+	size_t len = 0;
+	int nick = rand() % 1000;
+
+	if (r < opts->mix[0]) {
+		len += sprintf(p, ":nick%d!user%d@host-%d.example.com PRIVMSG #chan%d :",
+		               nick, nick, nick, rand() % 20);
+		len += gen_text(p + len, 20 + rand() % 80);
+	} else if ((r -= opts->mix[0]) < opts->mix[1]) {
+		switch (rand() % 3) {
+		case 0:
+			len += sprintf(p, ":irc.example.net 372 rpbot :- ");
+			len += gen_text(p + len, 60);
+			break;
+		case 1:
+			len += sprintf(p, ":irc.example.net 353 rpbot = #chan%d :", rand() % 20);
+			while (len < 400) {
+				len += sprintf(p + len, "%snick%d ",
+				               (rand() % 4) ? "" : "@", rand() % 10000);
+			}
+			break;
+		default:
+			len += sprintf(p, ":irc.example.net 005 rpbot CHANTYPES=# PREFIX=(ov)@+ NETWORK=Example NICKLEN=30 :are supported by this server");
+			break;
+		}
+	} else if ((r -= opts->mix[1]) < opts->mix[2]) {
+		len += sprintf(p, "@time=2024-01-01T00:00:%02d.%03dZ;msgid=%08x%08x;account=nick%d "
+		               ":nick%d!user%d@host-%d.example.com PRIVMSG #chan%d :",
+		               rand() % 60, rand() % 1000, rand(), rand(), nick,
+		               nick, nick, nick, rand() % 20);
+		len += gen_text(p + len, 20 + rand() % 80);
+	} else {
+		len += sprintf(p, ":nick%d!user%d@host-%d.example.com PRIVMSG #chan%d :",
+		               nick, nick, nick, rand() % 20);
+		len += gen_text(p + len, 400);
+		len = rp_min(len, (size_t)510);
+	}
+
+	p[len++] = '\r';
+	p[len++] = '\n';
+
+	return len;
+}
+
+// the buffer grows as lines are added, there is always room for one
+// more line at its end.
+static char *
+gen_corpus(const struct bench_opts *opts, size_t *len)
+{
+	size_t size = 0;
+	char *buf = NULL;
+	size_t i;
+
+	*len = 0;
+
+	for (i = 0; i < opts->lines; i++) {
+		if (size - *len < LINE_SZ) {
+			size_t n = size ? size * 2 : 64 * LINE_SZ;
+			char *b = realloc(buf, n);
+
+			if (!b) {
+				fprintf(stderr, "out of memory for %zu lines\n", opts->lines);
+				free(buf);
+				return NULL;
+			}
+
+			buf = b;
+			size = n;
+		}
+
+		*len += gen_line(buf + *len, opts);
+	}
+
+	return buf;
+}
+
+static char *
+load_corpus(const char *path, size_t *len)
+{
+	FILE *f = fopen(path, "rb");
+
+	if (!f) {
+		fprintf(stderr, "%s not found\n", path);
+		return NULL;
+	}
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char *buf = size > 0 ? malloc(size) : NULL;
+
+	if (!buf) {
+		fprintf(stderr, "can't load %s\n", path);
+		fclose(f);
+		return NULL;
+	}
+
+	*len = fread(buf, 1, size, f);
+	fclose(f);
+
+	return buf;
+}
+
+// parse everything in the fifo like main_loop does, returns the number
+// of messages.
+static size_t
+drain(rp_fifo_t *fifo, char *line_buf, struct rp_ircsm_msg *msgs)
+{
+	size_t total = 0;
+
+	while (rp_fifo_count(fifo) > 0) {
+		void *p;
+		size_t count = rp_fifo_count(fifo);
+		size_t n = rp_fifo_raw_r(fifo, &p);
+		size_t len = n;
+
+		total += rp_ircsm_parse_batch(msgs, BATCH_SZ, p, &len);
+
+		if (len > 0) {
+			rp_fifo_consume(fifo, len);
+			continue;
+		}
+
+		if (n < count) {
+			len = rp_fifo_peek(fifo, line_buf, count);
+
+			if (rp_ircsm_parse(&msgs[0], line_buf, &len)) {
+				rp_fifo_consume(fifo, len);
+				total++;
+				continue;
+			}
+		}
+
+		break;
+	}
+
+	return total;
+}
+
+static void
+usage(void)
+{
+	printf("\n");
+	printf("Usage: parse_bench [-n LINES] [-m PRIVMSG,NUMERIC,TAGGED,LONG]\n");
+	printf("                   [-c MAX_CHUNK] [-b FIFO_SZ] [-s SEED]\n");
+	printf("                   [-f CORPUS] [-o CORPUS_OUT]\n\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_opts opts = {
+		2000000, { 60, 25, 10, 5 }, 4096, 16 * 1024, 1, NULL, NULL
+	};
+	int c;
+
+	while ((c = getopt(argc, argv, "n:m:c:b:s:f:o:h")) != -1) {
+		switch (c) {
+		case 'n':
+			opts.lines = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			if (sscanf(optarg, "%u,%u,%u,%u", &opts.mix[0], &opts.mix[1],
+			           &opts.mix[2], &opts.mix[3]) != 4) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'c':
+			opts.max_chunk = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			opts.capacity = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			opts.seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			opts.corpus_in = optarg;
+			break;
+		case 'o':
+			opts.corpus_out = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (opts.max_chunk == 0 || opts.capacity == 0 ||
+	    opts.mix[0] + opts.mix[1] + opts.mix[2] + opts.mix[3] == 0) {
+		usage();
+		return 1;
+	}
+
+	rp_scan_init();
+	srand(opts.seed);
+
+	size_t len;
+	char *corpus = opts.corpus_in ? load_corpus(opts.corpus_in, &len)
+	                              : gen_corpus(&opts, &len);
+
+	if (!corpus) {
+		return 1;
+	}
+
+	if (opts.corpus_out) {
+		FILE *f = fopen(opts.corpus_out, "wb");
+
+		if (f) {
+			fwrite(corpus, 1, len, f);
+			fclose(f);
+		}
+	}
+
+	rp_fifo_t *fifo = malloc(sizeof(*fifo) + opts.capacity);
+	fifo->capacity = opts.capacity;
+	rp_fifo_init(fifo);
+
+	char *line_buf = malloc(opts.capacity);
+	struct rp_ircsm_msg msgs[BATCH_SZ];
+	size_t i;
+
+	for (i = 0; i < BATCH_SZ; i++) {
+		rp_ircsm_msg_init(&msgs[i]);
+	}
+
+	// the chunk sizes are drawn up front so rand() is not timed
+	size_t nchunks = len / (opts.max_chunk / 2 + 1) + 2;
+	size_t *chunks = malloc(nchunks * sizeof(*chunks));
+
+	for (i = 0; i < nchunks; i++) {
+		chunks[i] = 1 + rand() % opts.max_chunk;
+	}
+
+	size_t off = 0;
+	size_t msg_count = 0;
+	double start = now_sec();
+
+	for (i = 0; off < len; i = (i + 1) % nchunks) {
+		size_t n = rp_min(chunks[i], len - off);
+		n = rp_fifo_put(fifo, corpus + off, n);
+		off += n;
+
+		msg_count += drain(fifo, line_buf, msgs);
+
+		// a line that can never fit would stall the benchmark
+		if (n == 0 && rp_fifo_bytes_free(fifo) == 0) {
+			fprintf(stderr, "line longer than the fifo\n");
+			return 1;
+		}
+	}
+
+	double t = now_sec() - start;
+
+	printf("{\"bytes\": %zu, \"msgs\": %zu, \"secs\": %.6f, "
+	       "\"msgs_per_sec\": %.0f, \"ns_per_msg\": %.2f, \"bytes_per_sec\": %.0f}\n",
+	       len, msg_count, t,
+	       msg_count / t, t * 1e9 / msg_count, len / t);
+
+	free(chunks);
+	free(line_buf);
+	free(fifo);
+	free(corpus);
+
+	return 0;
+}
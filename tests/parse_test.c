@@ -1,8 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <rp_math.h>
 #include <rp_ircsm.h>
 
+// parser test. the lines of test_list are printed field by field, the
+// checks after them compare what the parser and the decoders make of
+// specific lines with the values they should have. exits non-zero if a
+// check failed.
+
 static const char *test_list[] = {
 	":Angel!wings@irc.org PRIVMSG Wiz :Are you receiving this message ?\r\n",
 	":WiZ!jto@tolsun.oulu.fi MODE #eu-opers -l\r\n",
@@ -10,8 +16,50 @@ static const char *test_list[] = {
 	":WiZ!jto@tolsun.oulu.fi JOIN #Twilight_zone\r\n",
 	":WiZ!jto@tolsun.oulu.fi PART #playzone :I lost\r\n",
 	"PING :irc.funet.fi\r\n",
+	":irc.funet.fi 353 rpbot = #test :@WiZ +Angel rpbot\r\n",
+	"@time=2011-10-19T16:40:51.620Z;msgid=63E1033A051D4B41B1AB1FA3CF4C243E :WiZ!jto@tolsun.oulu.fi PRIVMSG #test :Tagged\\sline\r\n",
 };
 
+static int failed;
+
+static void
+check(int ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+
+	if (!ok) {
+		failed = 1;
+	}
+}
+
+static void
+check_str(const rp_str_t *str, const char *expected, const char *name)
+{
+	char what[256];
+	const char *actual = str->len > 0 ? str->ptr : "";
+	int ok = str->len == strlen(expected) &&
+	         memcmp(actual, expected, str->len) == 0;
+
+	snprintf(what, sizeof(what), "%s is \"%s\" (\"%.*s\")", name, expected,
+	         (int)rp_min(str->len, 64), actual);
+	check(ok, what);
+}
+
+// parse a line that has to be accepted as a whole
+static int
+parse_ok(struct rp_ircsm_msg *msg, const char *line)
+{
+	char what[256];
+	size_t len = strlen(line);
+	int r = rp_ircsm_parse(msg, line, &len);
+
+	snprintf(what, sizeof(what), "accepted: %.*s", (int)rp_min(strcspn(line, "\r"), 64),
+	         line);
+	check(r == RP_IRCSM_OK && len == strlen(line), what);
+
+	return r == RP_IRCSM_OK;
+}
+
 void
 print_rp_str(const char *prefix, rp_str_t *str)
 {
@@ -23,11 +71,9 @@ print_rp_str(const char *prefix, rp_str_t *str)
 }
 
 void
-do_test(int *cs, struct rp_ircsm_msg *msg, const char *str)
+do_test(struct rp_ircsm_msg *msg, const char *str)
 {
-	size_t len = strlen(str);
-
-	if (rp_ircsm_parse(msg, cs, str, &len)) {
+	if (parse_ok(msg, str)) {
 		if (msg->is_hostmask) {
 			print_rp_str("nick", &msg->hostmask.nick);
 			print_rp_str("user", &msg->hostmask.user);
@@ -36,9 +82,393 @@ do_test(int *cs, struct rp_ircsm_msg *msg, const char *str)
 			print_rp_str("servername", &msg->servername);
 		}
 
+		rp_str_t time;
+		char buf[64];
+
+		if (rp_ircsm_tag_get(msg, "time", &time, buf, sizeof(buf))) {
+			print_rp_str("time", &time);
+		}
+
 		print_rp_str("code", &msg->code);
 		print_rp_str("params", &msg->params);
+
+		struct rp_ircsm_names names;
+		unsigned int i;
+
+		if (rp_ircsm_names_decode(msg, NULL, &names) == 0) {
+			for (i = 0; i < names.count; i++) {
+				print_rp_str("name prefix", &names.names[i].prefix);
+				print_rp_str("name nick", &names.names[i].nick);
+			}
+		}
+
+		for (i = 0; i < msg->argc; i++) {
+			char name[32];
+			snprintf(name, sizeof(name), "argv[%u]", i);
+			print_rp_str(name, &msg->argv[i]);
+		}
+	}
+}
+
+// parse a line the grammar rejects, it has to be consumed up to its crlf
+// with the error at offset error_at.
+static void
+parse_malformed(struct rp_ircsm_msg *msg, const char *src, size_t line_len,
+	size_t error_at, const char *name)
+{
+	char what[256];
+	size_t len = strlen(src);
+	int r = rp_ircsm_parse(msg, src, &len);
+
+	snprintf(what, sizeof(what), "%s is malformed (%d)", name, r);
+	check(r == RP_IRCSM_MALFORMED && msg->is_malformed, what);
+
+	snprintf(what, sizeof(what), "%s consumes %zu bytes (%zu)", name,
+	         line_len, len);
+	check(len == line_len && msg->line.len == line_len, what);
+
+	snprintf(what, sizeof(what), "%s is rejected at %zu (%ld)", name,
+	         error_at, (long)(msg->error_at - src));
+	check(msg->error_at == src + error_at, what);
+}
+
+static void
+test_malformed(void)
+{
+	struct rp_ircsm_msg msg, msgs[4];
+	u_char interest[RP_IRCSM_INTEREST_SZ];
+	char what[256];
+	size_t len, n;
+	int r;
+
+	rp_ircsm_msg_init(&msg);
+
+	for (n = 0; n < 4; n++) {
+		rp_ircsm_msg_init(&msgs[n]);
+	}
+
+	// garbage, then the parser picks up at the next line
+	const char *garbage = "\x01\x02 junk\r\nPING :x\r\n";
+
+	parse_malformed(&msg, garbage, 9, 0, "garbage");
+
+	len = strlen(garbage) - 9;
+	r = rp_ircsm_parse(&msg, garbage + 9, &len);
+	check(r == RP_IRCSM_OK && msg.cmd == RP_IRCSM_CMD_PING && len == 9,
+	      "the line after the garbage is accepted");
+
+	len = strlen(garbage);
+	n = rp_ircsm_parse_batch(msgs, 4, garbage, &len);
+	snprintf(what, sizeof(what), "a batch keeps the malformed line (%zu, %zu)",
+	         n, len);
+	check(n == 2 && len == strlen(garbage) && msgs[0].is_malformed &&
+	      !msgs[1].is_malformed && msgs[1].cmd == RP_IRCSM_CMD_PING, what);
+
+	// a bare lf does not end a line, the line goes on to the crlf
+	parse_malformed(&msg, "PING :x\nPONG :y\r\n", 17, 7, "a bare lf");
+
+	// a nickname is 16 characters at most
+	parse_malformed(&msg, ":[abcdefghijklmnop]!u@h PRIVMSG #c :x\r\n", 39, 17,
+	                "an oversized nickname");
+
+	parse_malformed(&msg, ":nick!user@ PRIVMSG #c :x\r\n", 27, 11,
+	                "a prefix without a host");
+	parse_malformed(&msg, ":-bad PRIVMSG #c :x\r\n", 21, 1,
+	                "a prefix with a bad first character");
+
+	// long lines are only limited by the read buffer
+	char long_line[8 * 1024];
+
+	len = (size_t)sprintf(long_line, "@+x=");
+	memset(long_line + len, 'v', 7000);
+	len += 7000;
+	len += (size_t)sprintf(long_line + len, " :n!u@h PRIVMSG #c :hi\r\n");
+
+	if (parse_ok(&msg, long_line)) {
+		check(msg.tags.len == 7003, "a 7k tag section is kept whole");
+	}
+
+	len = 7;
+	r = rp_ircsm_parse(&msg, "PING :x\r\n", &len);
+	check(r == RP_IRCSM_AGAIN && len == 7, "a line without its crlf waits");
+
+	// lines nobody asked for are skipped, but consumed
+	memset(interest, 0, sizeof(interest));
+	rp_ircsm_interest_set(interest, RP_IRCSM_CMD_PING);
+
+	const char *skip = ":n!u@h PRIVMSG #c :hi\r\nPING :x\r\n";
+
+	msg.interest = interest;
+	len = strlen(skip);
+	r = rp_ircsm_parse(&msg, skip, &len);
+	check(r == RP_IRCSM_SKIPPED && msg.is_skipped && len == 23,
+	      "PRIVMSG is skipped");
+	check(msg.cmd == RP_IRCSM_CMD_PRIVMSG, "a skipped line has its cmd");
+	check_str(&msg.code, "PRIVMSG", "code");
+	msg.interest = NULL;
+
+	msgs[0].interest = interest;
+	msgs[1].interest = interest;
+	len = strlen(skip);
+	n = rp_ircsm_parse_batch(msgs, 4, skip, &len);
+	check(n == 1 && len == strlen(skip) && msgs[0].cmd == RP_IRCSM_CMD_PING,
+	      "a skipped line takes no slot in a batch");
+}
+
+// a line that comes in piece by piece is only searched where it grew,
+// down to a crlf that is cut in half. the batch keeps the state of its
+// incomplete line in msgs[0], where the next batch starts.
+static void
+test_incomplete(void)
+{
+	struct rp_ircsm_msg msg, msgs[4];
+	char buf[1024], what[128];
+	size_t len, have, n;
+	int r = RP_IRCSM_AGAIN, resumed = 1;
+
+	rp_ircsm_msg_init(&msg);
+
+	// "PING :a\r\n", then a PRIVMSG of 497 bytes
+	memcpy(buf, "PING :a\r\nPRIVMSG #test :", 24);
+	memset(buf + 24, 'x', 480);
+	memcpy(buf + 504, "\r\n", 2);
+
+	for (have = 1; have <= 497 && r == RP_IRCSM_AGAIN; have++) {
+		len = have;
+		r = rp_ircsm_parse(&msg, buf + 9, &len);
+
+		if (r == RP_IRCSM_AGAIN &&
+		    (msg.scan_src != buf + 9 || msg.scanned != have - 1)) {
+			resumed = 0;
+		}
+	}
+
+	snprintf(what, sizeof(what), "a line fed a byte at a time is "
+	         "complete at its crlf (%d, %zu)", r, have - 1);
+	check(r == RP_IRCSM_OK && have - 1 == 497 && len == 497 &&
+	      msg.line.len == 497, what);
+	check(resumed && msg.scan_src == NULL,
+	      "the search goes on where it stopped until the line is complete");
+
+	// a line put where an incomplete one was needs a reset
+	len = 200;
+	r = rp_ircsm_parse(&msg, buf + 9, &len);
+	memcpy(buf + 9, "PING :y\r\n", 9);
+	rp_ircsm_scan_reset(&msg);
+	len = 200;
+	check(r == RP_IRCSM_AGAIN && rp_ircsm_parse(&msg, buf + 9, &len) ==
+	      RP_IRCSM_OK && len == 9, "a reset searches from the start");
+	memcpy(buf + 9, "PRIVMSG #test :", 15);
+
+	for (n = 0; n < 4; n++) {
+		rp_ircsm_msg_init(&msgs[n]);
+	}
+
+	len = 300;
+	n = rp_ircsm_parse_batch(msgs, 4, buf, &len);
+	check(n == 1 && len == 9, "a batch stops at the incomplete line");
+	check(msgs[0].scan_src == buf + 9 && msgs[0].scanned == 290 &&
+	      msgs[1].scan_src == NULL, "its state is kept in msgs[0]");
+
+	len = 506 - 9;
+	n = rp_ircsm_parse_batch(msgs, 4, buf + 9, &len);
+	check(n == 1 && len == 497 && msgs[0].line.len == 497,
+	      "the next batch completes it");
+}
+
+static void
+test_argv(void)
+{
+	struct rp_ircsm_msg msg;
+
+	rp_ircsm_msg_init(&msg);
+
+	if (parse_ok(&msg, ":WiZ!jto@tolsun.oulu.fi PART #playzone :I lost\r\n")) {
+		check(msg.argc == 2 && msg.is_trailing, "PART has a middle and a trailing param");
+		check_str(&msg.argv[0], "#playzone", "argv[0]");
+		check_str(&msg.argv[1], "I lost", "argv[1]");
+		check_str(&msg.params, "#playzone :I lost", "params");
+	}
+
+	if (parse_ok(&msg, ":WiZ!jto@tolsun.oulu.fi MODE #eu-opers -l\r\n")) {
+		check(msg.argc == 2 && !msg.is_trailing, "MODE has two middle params");
+		check_str(&msg.argv[0], "#eu-opers", "argv[0]");
+		check_str(&msg.argv[1], "-l", "argv[1]");
+	}
+
+	// colons inside of a trailing param are text
+	if (parse_ok(&msg, "PRIVMSG #c ::) a :b\r\n")) {
+		check(msg.argc == 2 && msg.is_trailing, "PRIVMSG has 2 params");
+		check_str(&msg.argv[1], ":) a :b", "argv[1]");
+	}
+
+	if (parse_ok(&msg, "PRIVMSG #c :\r\n")) {
+		check(msg.argc == 2 && msg.is_trailing, "an empty trailing param counts");
+		check_str(&msg.argv[1], "", "argv[1]");
+	}
+
+	if (parse_ok(&msg, "QUIT\r\n")) {
+		check(msg.argc == 0 && !msg.is_trailing, "QUIT has no params");
+		check(msg.params.len == 0, "params is empty");
+	}
+
+	if (parse_ok(&msg, "X 1 2 3 4 5 6 7 8 9 10 11 12 13 14 :15 and more\r\n")) {
+		check(msg.argc == 15 && msg.is_trailing, "15 params, the last trailing");
+		check_str(&msg.argv[13], "14", "argv[13]");
+		check_str(&msg.argv[14], "15 and more", "argv[14]");
+	}
+
+	// past 14 middle params the rest of the line is the last one
+	if (parse_ok(&msg, "X 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 :17\r\n")) {
+		check(msg.argc == RP_IRCSM_MAX_PARAMS && msg.is_trailing,
+		      "the 15th param is trailing without a colon");
+		check_str(&msg.argv[13], "14", "argv[13]");
+		check_str(&msg.argv[14], "15 16 :17", "argv[14]");
+	}
+}
+
+static void
+test_tags(void)
+{
+	struct rp_ircsm_msg msg;
+	rp_str_t value;
+	char buf[64], small[4];
+
+	rp_ircsm_msg_init(&msg);
+
+	// the line of test_list, the trailing text is not a tag value and
+	// stays escaped
+	if (parse_ok(&msg, test_list[7])) {
+		check_str(&msg.tags, "time=2011-10-19T16:40:51.620Z;msgid=63E1033A051D4B41B1AB1FA3CF4C243E",
+		          "tags");
+		check(rp_ircsm_tag_get(&msg, "time", &value, buf, sizeof(buf)) == 1,
+		      "time is found");
+		check_str(&value, "2011-10-19T16:40:51.620Z", "time");
+		check(value.ptr > msg.line.ptr && value.ptr < msg.line.ptr + msg.line.len,
+		      "time points into the line");
+		check(rp_ircsm_tag_get(&msg, "msgid", &value, buf, sizeof(buf)) == 1,
+		      "msgid is found");
+		check_str(&value, "63E1033A051D4B41B1AB1FA3CF4C243E", "msgid");
+		check_str(&msg.argv[1], "Tagged\\sline", "argv[1]");
+	}
+
+	if (parse_ok(&msg, "@a=x\\sy;b=1\\:2;c=back\\\\slash;d=trail\\;e;+example.com/f=\\r\\n :n!u@h PRIVMSG #c :hi\r\n")) {
+		check(rp_ircsm_tag_get(&msg, "a", &value, buf, sizeof(buf)) == 1, "a is found");
+		check_str(&value, "x y", "a");
+		check(value.ptr == buf, "a is unescaped into buf");
+		check(rp_ircsm_tag_get(&msg, "b", &value, buf, sizeof(buf)) == 1, "b is found");
+		check_str(&value, "1;2", "b");
+		check(rp_ircsm_tag_get(&msg, "c", &value, buf, sizeof(buf)) == 1, "c is found");
+		check_str(&value, "back\\slash", "c");
+		check(rp_ircsm_tag_get(&msg, "d", &value, buf, sizeof(buf)) == 1, "d is found");
+		check_str(&value, "trail", "d, the trailing backslash is dropped");
+		check(rp_ircsm_tag_get(&msg, "e", &value, buf, sizeof(buf)) == 1, "e is found");
+		check_str(&value, "", "e, a tag without a value");
+		check(rp_ircsm_tag_get(&msg, "+example.com/f", &value, buf, sizeof(buf)) == 1,
+		      "+example.com/f is found");
+		check(value.len == 2 && memcmp(value.ptr, "\r\n", 2) == 0,
+		      "+example.com/f is a crlf");
+
+		// only whole keys match
+		check(rp_ircsm_tag_get(&msg, "back", &value, buf, sizeof(buf)) == 0,
+		      "a value is not a key");
+		check(rp_ircsm_tag_get(&msg, "+example", &value, buf, sizeof(buf)) == 0,
+		      "a part of a key is not a key");
+
+		check(rp_ircsm_tag_get(&msg, "c", &value, small, sizeof(small)) == 1,
+		      "c is found with a small buffer");
+		check_str(&value, "back", "c cut to the buffer");
+	}
+
+	if (parse_ok(&msg, ":n!u@h PRIVMSG #c :hi\r\n")) {
+		check(msg.tags.len == 0, "an untagged line has no tags");
+		check(rp_ircsm_tag_get(&msg, "time", &value, buf, sizeof(buf)) == 0,
+		      "time is not found");
+	}
+}
+
+static void
+test_decoders(void)
+{
+	struct rp_ircsm_msg msg;
+	struct rp_ircsm_names names;
+	struct rp_ircsm_who who;
+	struct rp_ircsm_isupport isupport;
+	rp_str_t modes, prefixes;
+
+	rp_ircsm_msg_init(&msg);
+
+	if (parse_ok(&msg, ":irc.funet.fi 353 rpbot = #test :@WiZ +Angel rpbot\r\n")) {
+		check(rp_ircsm_names_decode(&msg, NULL, &names) == 0, "353 decodes");
+		check(names.type == '=', "353 is a public channel");
+		check_str(&names.channel, "#test", "353 channel");
+		check(names.count == 3, "353 has 3 names");
+		check_str(&names.names[0].prefix, "@", "names[0] prefix");
+		check_str(&names.names[0].nick, "WiZ", "names[0] nick");
+		check_str(&names.names[1].prefix, "+", "names[1] prefix");
+		check_str(&names.names[1].nick, "Angel", "names[1] nick");
+		check_str(&names.names[2].prefix, "", "names[2] prefix");
+		check_str(&names.names[2].nick, "rpbot", "names[2] nick");
+	}
+
+	// multi-prefix, only the prefixes of the server count
+	if (parse_ok(&msg, ":s 353 me @ #c :@+a ~b\r\n")) {
+		check(rp_ircsm_names_decode(&msg, "@+", &names) == 0, "353 decodes");
+		check(names.type == '@', "353 is a secret channel");
+		check(names.count == 2, "353 has 2 names");
+		check_str(&names.names[0].prefix, "@+", "names[0] prefix");
+		check_str(&names.names[0].nick, "a", "names[0] nick");
+		check_str(&names.names[1].prefix, "", "names[1] prefix");
+		check_str(&names.names[1].nick, "~b", "names[1] nick");
+	}
+
+	if (parse_ok(&msg, ":s 352 me #c ~u host.example srv.example nick H* :3 Real Name\r\n")) {
+		check(rp_ircsm_names_decode(&msg, NULL, &names) == -1, "352 is not a 353");
+		check(rp_ircsm_who_decode(&msg, &who) == 0, "352 decodes");
+		check_str(&who.channel, "#c", "352 channel");
+		check_str(&who.user, "~u", "352 user");
+		check_str(&who.host, "host.example", "352 host");
+		check_str(&who.server, "srv.example", "352 server");
+		check_str(&who.nick, "nick", "352 nick");
+		check_str(&who.flags, "H*", "352 flags");
+		check(!who.is_away && who.is_oper, "352 is here and an oper");
+		check(who.hopcount == 3, "352 hopcount is 3");
+		check_str(&who.realname, "Real Name", "352 realname");
+	}
+
+	if (parse_ok(&msg, ":s 352 me * u h s n G :0 \r\n")) {
+		check(rp_ircsm_who_decode(&msg, &who) == 0, "352 decodes");
+		check(who.is_away && !who.is_oper, "352 is away");
+		check(who.hopcount == 0, "352 hopcount is 0");
+		check_str(&who.realname, "", "352 realname");
 	}
+
+	if (parse_ok(&msg, ":s 005 me CHANTYPES=# -EXCEPTS PREFIX=(ov)@+ :are supported by this server\r\n")) {
+		check(rp_ircsm_isupport_decode(&msg, &isupport) == 0, "005 decodes");
+		check(isupport.count == 3, "005 has 3 tokens, the trailing text is none");
+		check_str(&isupport.tokens[0].key, "CHANTYPES", "tokens[0] key");
+		check_str(&isupport.tokens[0].value, "#", "tokens[0] value");
+		check(isupport.tokens[1].is_negated, "tokens[1] is negated");
+		check_str(&isupport.tokens[1].key, "EXCEPTS", "tokens[1] key");
+		check_str(&isupport.tokens[1].value, "", "tokens[1] value");
+		check_str(&isupport.tokens[2].key, "PREFIX", "tokens[2] key");
+		check(rp_ircsm_isupport_prefix(&isupport.tokens[2].value, &modes,
+		                               &prefixes) == 0, "PREFIX splits");
+		check_str(&modes, "ov", "PREFIX modes");
+		check_str(&prefixes, "@+", "PREFIX prefixes");
+	}
+
+	// without the trailing text the last token is still one
+	if (parse_ok(&msg, ":s 005 me NETWORK=Example CHANTYPES=#&\r\n")) {
+		check(rp_ircsm_isupport_decode(&msg, &isupport) == 0, "005 decodes");
+		check(isupport.count == 2, "005 has 2 tokens");
+		check_str(&isupport.tokens[1].key, "CHANTYPES", "tokens[1] key");
+		check_str(&isupport.tokens[1].value, "#&", "tokens[1] value");
+	}
+
+	rp_str_t bad = rp_string("(ov)@");
+	check(rp_ircsm_isupport_prefix(&bad, &modes, &prefixes) == -1,
+	      "PREFIX with a prefix missing is rejected");
 }
 
 int
@@ -47,20 +477,22 @@ main(int argc, const char **argv)
 	(void)argc;
 	(void)argv;
 
-	rp_pool_t *pool = rp_create_pool(RP_DEFAULT_POOL_SIZE);
-
 	struct rp_ircsm_msg msg;
-	rp_ircsm_msg_init(pool, &msg);
+	rp_ircsm_msg_init(&msg);
 
 	int i;
-	int cs;
-	rp_ircsm_init(&cs);
 
 	for (i = 0; i < (int)(sizeof(test_list) / sizeof(test_list[0])); i++) {
-		do_test(&cs, &msg, test_list[i]);
+		do_test(&msg, test_list[i]);
 		printf("\n");
 	}
 
-	return 0;
+	test_malformed();
+	test_incomplete();
+	test_argv();
+	test_tags();
+	test_decoders();
+
+	return failed;
 }
 
@@ -6,18 +6,62 @@ d              := $(dir)
 STD_INC_$(d) := -I$(d)/../src/util -I$(d)/../src/ircsm
 STD_LIB_$(d) := $(d)/../src/util/util.a $(d)/../src/ircsm/ircsm.a
 
-OBJS_$(d) := $(d)/parse_test.o
-TGTS_$(d) := $(d)/parse_test
+OBJS_$(d) := $(d)/parse_test.o \
+             $(d)/scan_bench.o \
+             $(d)/parse_bench.o \
+             $(d)/event_bench.o \
+             $(d)/dns_test.o \
+             $(d)/irc_test.o \
+             $(d)/timer_test.o
+TGTS_$(d) := $(d)/parse_test \
+             $(d)/scan_bench \
+             $(d)/parse_bench \
+             $(d)/event_bench \
+             $(d)/dns_test \
+             $(d)/irc_test \
+             $(d)/timer_test
 
 DEPS_$(d) := $(OBJS_$(d):%=%.d)
-CLEAN := $(CLEAN) $(OBJS_$(d)) $(DEPS_$(d)) $(d)/parse_test
+CLEAN := $(CLEAN) $(OBJS_$(d)) $(DEPS_$(d)) $(TGTS_$(d))
 
 $(OBJS_$(d)): CF_TGT := $(STD_INC_$(d))
 
 $(d)/parse_test: LL_TGT := $(STD_LIB_$(d))
-$(d)/parse_test: $(OBJS_$(d)) src/util/util.a src/ircsm/ircsm.a
+$(d)/parse_test: $(d)/parse_test.o src/util/util.a src/ircsm/ircsm.a
 	$(LINK)
 
+$(d)/scan_bench: LL_TGT := $(STD_LIB_$(d))
+$(d)/scan_bench: $(d)/scan_bench.o src/util/util.a src/ircsm/ircsm.a
+	$(LINK)
+
+$(d)/parse_bench: LL_TGT := $(STD_LIB_$(d))
+$(d)/parse_bench: $(d)/parse_bench.o src/util/util.a src/ircsm/ircsm.a
+	$(LINK)
+
+$(d)/timer_test: LL_TGT := $(STD_LIB_$(d))
+$(d)/timer_test: $(d)/timer_test.o src/util/util.a
+	$(LINK)
+
+# the event loop lives in src/ with rpbot, it is linked in directly
+$(d)/event_bench.o: CF_TGT := $(STD_INC_$(d)) -I$(d)/../src
+$(d)/event_bench: LL_TGT := $(STD_LIB_$(d)) -lpthread
+$(d)/event_bench: $(d)/event_bench.o src/rp_event.o src/rp_dns.o src/util/util.a
+	$(LINK)
+
+$(d)/dns_test.o: CF_TGT := $(STD_INC_$(d)) -I$(d)/../src
+$(d)/dns_test: LL_TGT := $(STD_LIB_$(d)) -lpthread
+$(d)/dns_test: $(d)/dns_test.o src/rp_event.o src/rp_dns.o src/util/util.a
+	$(LINK)
+
+# the connection is tested without a server, its write buffer is read back
+$(d)/irc_test.o: CF_TGT := $(STD_INC_$(d)) -I$(d)/../src
+$(d)/irc_test: LL_TGT := $(STD_LIB_$(d))
+$(d)/irc_test: $(d)/irc_test.o src/rp_irc.o src/util/util.a src/ircsm/ircsm.a
+	$(LINK)
+
+.PHONY: parse_bench
+parse_bench: $(d)/parse_bench
+
 TGT_TESTS := $(TGT_TESTS) $(TGTS_$(d))
 
 # standard
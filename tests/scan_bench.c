@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <rp_scan.h>
+#include <rp_ircsm.h>
+
+#define CORPUS_SZ (16 * 1024 * 1024)
+#define ROUNDS 8
+
+static const char *line_list[] = {
+	":Angel!wings@irc.org PRIVMSG #rpbot :Are you receiving this message ?\r\n",
+	":irc.funet.fi 353 rpbot = #rpbot :@WiZ +Angel rpbot foo bar baz qux quux corge grault garply waldo fred plugh\r\n",
+	":WiZ!jto@tolsun.oulu.fi MODE #eu-opers -l\r\n",
+	":irc.funet.fi 372 rpbot :- This is the message of the day, it goes on for a while and nobody reads it\r\n",
+	":WiZ!jto@tolsun.oulu.fi JOIN #Twilight_zone\r\n",
+	"PING :irc.funet.fi\r\n",
+};
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t
+make_corpus(char *buf, size_t size)
+{
+	size_t len = 0;
+	int i = 0;
+
+	for (;;) {
+		const char *l = line_list[i++ % (sizeof(line_list) / sizeof(line_list[0]))];
+		size_t n = strlen(l);
+
+		if (len + n > size) {
+			break;
+		}
+
+		memcpy(buf + len, l, n);
+		len += n;
+	}
+
+	return len;
+}
+
+// a byte at a time, the way the line end was found before the scanners
+// when the machine walked the buffer on its own. the baseline for them.
+static const char *
+scan_crlf_bytes(const char *p, size_t len)
+{
+	const char *end = p + len;
+
+	for (; p + 1 < end; p++) {
+		if (p[0] == '\r' && p[1] == '\n') {
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+bench_scan(const char *name, rp_scan_crlf_t scan, const char *buf, size_t len)
+{
+	size_t lines = 0;
+	double start = now_sec();
+	int r;
+
+	for (r = 0; r < ROUNDS; r++) {
+		const char *p = buf;
+		const char *end = buf + len;
+		const char *eol;
+
+		while ((eol = scan(p, end - p)) != NULL) {
+			p = eol + 2;
+			lines++;
+		}
+	}
+
+	double t = now_sec() - start;
+
+	printf("scan  %-6s %8.1f MB/s  %zu lines\n", name,
+	       (double)len * ROUNDS / t / (1024 * 1024), lines / ROUNDS);
+}
+
+static void
+bench_parse(const char *name, rp_scan_crlf_t scan, const char *buf, size_t len)
+{
+	struct rp_ircsm_msg msgs[64];
+	size_t msg_count = 0;
+	double start;
+	int r;
+
+	for (r = 0; r < 64; r++) {
+		rp_ircsm_msg_init(&msgs[r]);
+	}
+
+	rp_scan_crlf = scan;
+	start = now_sec();
+
+	for (r = 0; r < ROUNDS; r++) {
+		size_t off = 0;
+
+		while (off < len) {
+			size_t l = len - off;
+			size_t n = rp_ircsm_parse_batch(msgs, 64, buf + off, &l);
+
+			if (n == 0) {
+				break;
+			}
+
+			off += l;
+			msg_count += n;
+		}
+	}
+
+	double t = now_sec() - start;
+
+	printf("parse %-6s %8.1f MB/s  %zu msgs\n", name,
+	       (double)len * ROUNDS / t / (1024 * 1024), msg_count / ROUNDS);
+}
+
+int
+main(int argc, const char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	char *buf = malloc(CORPUS_SZ);
+	size_t len = make_corpus(buf, CORPUS_SZ);
+
+	bench_scan("bytes", scan_crlf_bytes, buf, len);
+	bench_scan("scalar", rp_scan_crlf_scalar, buf, len);
+#if (RP_SCAN_HAVE_SIMD)
+	bench_scan("sse2", rp_scan_crlf_sse2, buf, len);
+	if (rp_scan_have_avx2()) {
+		bench_scan("avx2", rp_scan_crlf_avx2, buf, len);
+	}
+#endif
+
+	bench_parse("bytes", scan_crlf_bytes, buf, len);
+	bench_parse("scalar", rp_scan_crlf_scalar, buf, len);
+#if (RP_SCAN_HAVE_SIMD)
+	bench_parse("sse2", rp_scan_crlf_sse2, buf, len);
+	if (rp_scan_have_avx2()) {
+		bench_parse("avx2", rp_scan_crlf_avx2, buf, len);
+	}
+#endif
+
+	free(buf);
+
+	return 0;
+}
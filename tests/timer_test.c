@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rp_timer.h>
+
+// timer wheel test. timers at the edges of the levels and a spread of
+// them over every level and the overflow list have to fire exactly at
+// their deadline, no matter if the wheel advances a tick at a time or
+// jumps. rp_timer_next may ask for a wakeup before a deadline while a
+// timer moves down the levels but never after it.
+
+#define N_SPREAD 512
+
+struct fired {
+	rp_timer_wheel_t *wheel;
+	rp_timer_t        timer;
+	unsigned          count;
+	uintptr_t         at; // the time of the wheel when it ran
+};
+
+static int failed;
+
+static void
+check(int ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+
+	if (!ok) {
+		failed = 1;
+	}
+}
+
+static void
+handle_fired(rp_timer_t *timer)
+{
+	struct fired *f = timer->data;
+
+	f->count++;
+	f->at = f->wheel->now;
+}
+
+static void
+fired_init(struct fired *f, rp_timer_wheel_t *wheel)
+{
+	memset(f, 0, sizeof(*f));
+	f->wheel = wheel;
+	rp_timer_init(&f->timer, handle_fired, f);
+}
+
+// a timer delay ms after start fires at start + delay and not a tick
+// earlier, and rp_timer_next never points past it.
+static void
+test_edge(uintptr_t start, uintptr_t delay)
+{
+	rp_timer_wheel_t wheel;
+	struct fired f;
+	uintptr_t next;
+	char what[128];
+
+	rp_timer_wheel_init(&wheel, start);
+	fired_init(&f, &wheel);
+	rp_timer_add(&wheel, &f.timer, start + delay);
+
+	next = rp_timer_next(&wheel);
+	snprintf(what, sizeof(what), "next for %lu ms after %lu is in (now, %lu]",
+	         (unsigned long)delay, (unsigned long)start,
+	         (unsigned long)(start + delay));
+	check(next > start && next <= start + delay, what);
+
+	rp_timer_expire(&wheel, start + delay - 1);
+	snprintf(what, sizeof(what), "%lu ms after %lu does not fire early",
+	         (unsigned long)delay, (unsigned long)start);
+	check(f.count == 0 && rp_timer_active(&f.timer), what);
+
+	rp_timer_expire(&wheel, start + delay);
+	snprintf(what, sizeof(what), "%lu ms after %lu fires on time",
+	         (unsigned long)delay, (unsigned long)start);
+	check(f.count == 1 && f.at == start + delay && !rp_timer_active(&f.timer),
+	      what);
+
+	check(rp_timer_next(&wheel) == RP_TIMER_INFINITE && wheel.count == 0,
+	      "the wheel is empty afterwards");
+}
+
+static void
+test_edges(void)
+{
+	static const uintptr_t delays[] = {
+		1, 63, 64, 65, 4095, 4096, 4097, 262143, 262144,
+		(uintptr_t)1 << 30, ((uintptr_t)1 << 30) + 1,
+	};
+	static const uintptr_t starts[] = { 0, 100, 4095, 262140 };
+	size_t i, j;
+
+	for (i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+		for (j = 0; j < sizeof(delays) / sizeof(delays[0]); j++) {
+			test_edge(starts[i], delays[j]);
+		}
+	}
+}
+
+static void
+test_cancel(void)
+{
+	rp_timer_wheel_t wheel;
+	struct fired a, b, c;
+
+	rp_timer_wheel_init(&wheel, 1000);
+	fired_init(&a, &wheel);
+	fired_init(&b, &wheel);
+	fired_init(&c, &wheel);
+
+	rp_timer_add(&wheel, &a.timer, 1010);
+	rp_timer_add(&wheel, &b.timer, 1010);
+	rp_timer_add(&wheel, &c.timer, 1000 + 5000);
+	rp_timer_del(&wheel, &a.timer);
+	rp_timer_del(&wheel, &c.timer);
+	rp_timer_del(&wheel, &c.timer);
+
+	check(wheel.count == 1 && !rp_timer_active(&a.timer),
+	      "cancelled timers leave the wheel, twice is harmless");
+	check(rp_timer_next(&wheel) == 1010, "next is the remaining timer");
+
+	rp_timer_expire(&wheel, 10000);
+	check(a.count == 0 && b.count == 1 && c.count == 0,
+	      "only the timer that was not cancelled fires");
+
+	// moving an armed timer
+	rp_timer_add(&wheel, &a.timer, 20000);
+	rp_timer_add(&wheel, &a.timer, 10100);
+	check(wheel.count == 1 && rp_timer_next(&wheel) <= 10100,
+	      "adding an armed timer moves it");
+
+	rp_timer_expire(&wheel, 30000);
+	check(a.count == 1 && a.at == 10100, "a moved timer fires once");
+
+	// a deadline that passed fires on the next tick
+	rp_timer_add(&wheel, &a.timer, 100);
+	check(rp_timer_next(&wheel) == 30001, "a past deadline is due next tick");
+
+	rp_timer_expire(&wheel, 30001);
+	check(a.count == 2 && a.at == 30001, "a past deadline fires");
+}
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uintptr_t
+xorshift(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return (uintptr_t)rng;
+}
+
+// timers with deadlines up to 2^bits ms away, fired by a wheel that
+// advances in random steps of up to max_step ms. each one runs once, at
+// its deadline, in the call whose now reached it.
+static void
+test_spread(unsigned bits, uintptr_t max_step)
+{
+	rp_timer_wheel_t wheel;
+	struct fired *f = calloc(N_SPREAD, sizeof(*f));
+	uintptr_t now = 12345, last, end = 0;
+	unsigned i, on_time = 0, missed = 0, next_late = 0;
+	char what[128];
+
+	if (!f) {
+		check(0, "out of memory");
+		return;
+	}
+
+	rp_timer_wheel_init(&wheel, now);
+
+	for (i = 0; i < N_SPREAD; i++) {
+		uintptr_t delay = 1 + xorshift() % ((uintptr_t)1 << (1 + i % bits));
+
+		fired_init(&f[i], &wheel);
+		rp_timer_add(&wheel, &f[i].timer, now + delay);
+		end = end > now + delay ? end : now + delay;
+	}
+
+	// a timer that got lost would keep the wheel busy forever
+	while (wheel.count > 0 && now <= end) {
+		uintptr_t next = rp_timer_next(&wheel), first = RP_TIMER_INFINITE;
+
+		for (i = 0; i < N_SPREAD; i++) {
+			if (rp_timer_active(&f[i].timer) && f[i].timer.expires < first) {
+				first = f[i].timer.expires;
+			}
+		}
+
+		if (next <= now || next > first) {
+			next_late++;
+		}
+
+		last = now;
+		now += 1 + xorshift() % max_step;
+
+		rp_timer_expire(&wheel, now);
+
+		for (i = 0; i < N_SPREAD; i++) {
+			uintptr_t expires = f[i].timer.expires;
+
+			if (f[i].count && f[i].at > last) {
+				on_time += f[i].at == expires && expires <= now;
+			} else if (!f[i].count && expires <= now) {
+				missed++;
+			}
+		}
+	}
+
+	for (i = 0; i < N_SPREAD; i++) {
+		if (f[i].count != 1) {
+			missed++;
+		}
+	}
+
+	snprintf(what, sizeof(what), "%u timers up to 2^%u ms, steps up to %lu ms, "
+	         "fire on time", N_SPREAD, bits, (unsigned long)max_step);
+	check(on_time == N_SPREAD && missed == 0, what);
+
+	snprintf(what, sizeof(what), "next is after now and never past a deadline "
+	         "(2^%u ms, steps up to %lu ms)", bits, (unsigned long)max_step);
+	check(next_late == 0, what);
+
+	free(f);
+}
+
+// a handler that arms its own timer again for now runs on the next tick,
+// not in the same expire.
+static void
+handle_rearm(rp_timer_t *timer)
+{
+	struct fired *f = timer->data;
+
+	handle_fired(timer);
+
+	if (f->count < 3) {
+		rp_timer_add(f->wheel, timer, f->wheel->now);
+	}
+}
+
+static void
+test_rearm(void)
+{
+	rp_timer_wheel_t wheel;
+	struct fired f;
+
+	rp_timer_wheel_init(&wheel, 63);
+	fired_init(&f, &wheel);
+	rp_timer_init(&f.timer, handle_rearm, &f);
+	rp_timer_add(&wheel, &f.timer, 64);
+
+	rp_timer_expire(&wheel, 64);
+	check(f.count == 1 && rp_timer_next(&wheel) == 65,
+	      "a timer armed by its handler waits for the next tick");
+
+	rp_timer_expire(&wheel, 1000);
+	check(f.count == 3 && f.at == 66, "it fires once per tick");
+}
+
+int
+main(int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+
+	test_edges();
+	test_cancel();
+	test_rearm();
+	test_spread(16, 1);
+	test_spread(20, 64);
+	test_spread(26, 5000);
+
+	// two bits past the top level, so the overflow list takes part
+	test_spread(32, (uintptr_t)1 << 28);
+
+	return failed;
+}